@@ -433,6 +433,7 @@ extern INA_TLS(ina_rc_t) __rc;
 #define INA_ERR_OUT_OF_MEMORY     (INA_ERR_OUT_OF|INA_ES_MEMORY)
 #define INA_ERR_INVALID_PATTERN   (INA_ERR_INVALID|INA_ES_PATTERN)
 #define INA_ERR_POOL_FULL         (INA_ERR_FULL|INA_ES_POOL)
+#define INA_ERR_POOL_LIMIT        (INA_ERR_EXCEEDED|INA_ES_POOL)
 #define INA_ERR_OPERATION_INVALID (INA_ES_OPERATION|INA_ERR_INVALID)
 
 /*
@@ -61,7 +61,10 @@ extern "C" {
 #include <libinac-ce/memory.h>
 #include <libinac-ce/mempool.h>
 #include <libinac-ce/string.h>
+#include <libinac-ce/slab.h>
 #include <libinac-ce/list.h>
+#include <libinac-ce/memprof.h>
+#include <libinac-ce/shmring.h>
 
 
 #define INA_UNUSED(x) (void)(x)
@@ -36,6 +36,10 @@ INA_API(ina_rc_t) ina_list_new(uint32_t cf, ina_list_t **list);
 INA_API(ina_rc_t) ina_list_new_from_hashtable(ina_hashtable_t *ht, ina_list_t **list);
 #endif
 
+/*
+ * Reserve room for min_nodes. max_recyclable_nodes has no effect and is kept
+ * for compatibility, freed nodes always go back to the slab of the list.
+ */
 INA_API(ina_rc_t) ina_list_resize(ina_list_t *list, size_t min_nodes, size_t max_recyclable_nodes);
 
 INA_API(void)     ina_list_free(ina_list_t **list);
@@ -19,6 +19,9 @@ extern "C" {
 #ifndef INA_MEM_MALLOC
 #define INA_MEM_MALLOC malloc
 #endif
+#ifndef INA_MEM_CALLOC
+#define INA_MEM_CALLOC calloc
+#endif
 #ifndef INA_MEM_REALLOC
 #define INA_MEM_REALLOC realloc
 #endif
@@ -40,6 +43,21 @@ extern "C" {
 #ifndef INA_MEM_FREE
 #define INA_MEM_FREE free
 #endif
+/* Aligned allocation, same signature as posix_memalign */
+#ifndef INA_MEM_MEMALIGN
+#ifdef INA_OS_WIN32
+#define INA_MEM_MEMALIGN(pp, a, n) ((*(pp) = _aligned_malloc(n, a)) == NULL ? ENOMEM : 0)
+#else
+#define INA_MEM_MEMALIGN posix_memalign
+#endif
+#endif
+#ifndef INA_MEM_ALIGNED_FREE
+#ifdef INA_OS_WIN32
+#define INA_MEM_ALIGNED_FREE _aligned_free
+#else
+#define INA_MEM_ALIGNED_FREE free
+#endif
+#endif
 
 /* Align to 2x word size (as GNU libc does). */
 #define INA_MEM_ALIGN_SIZE (2 * sizeof(void*))
@@ -47,6 +65,12 @@ extern "C" {
 /* Round up 'n' to a multiple of ALIGN_SIZE. */
 #define INA_MEM_ALIGN(n) ((n+(INA_MEM_ALIGN_SIZE-1)) & (~(INA_MEM_ALIGN_SIZE-1)))
 
+/* Round up 'n' to a multiple of 'a', 'a' must be a power of two */
+#define INA_MEM_ALIGN_TO(n, a) (((n)+((a)-1)) & (~((size_t)(a)-1)))
+
+/* Size of a cache line */
+#define INA_MEM_CACHELINE_SIZE (64)
+
 #define INA_MEM_IS_ALIGNED(ptr, alignment) \
     (((uintptr_t)(const void *)(ptr)) % (alignment) == 0)
 
@@ -57,6 +81,45 @@ extern "C" {
 
 #define INA_MEM_SET_ZERO(ptr, type) ina_mem_set(ptr, 0, sizeof(type))
 
+/*
+ * Allocator backend of the ina_mem_* functions. free and realloc must accept
+ * blocks of alloc_aligned. usable_size is optional.
+ */
+typedef struct ina_mem_allocator_s {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *(*alloc_aligned)(void *ctx, size_t alignment, size_t size);
+    size_t (*usable_size)(void *ctx, void *ptr);
+    void *ctx;   /* passed to all functions */
+} ina_mem_allocator_t;
+
+/*
+ * Install an allocator backend. Must be called before the first allocation
+ * (before ina_init()), memory allocated by the previous backend can not be
+ * freed by the new one.
+ *
+ * Parameters
+ *  allocator  Allocator functions, copied. NULL restores the default
+ *             (INA_MEM_MALLOC, INA_MEM_REALLOC, INA_MEM_FREE, ...).
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_mem_set_allocator(const ina_mem_allocator_t *allocator);
+
+/*
+ * Get the usable size of a memory block allocated by ina_mem_alloc(), which
+ * may be larger than requested.
+ *
+ * Parameters
+ *  ptr  Memory block
+ *
+ * Return
+ *  Usable size in bytes, 0 if unknown.
+ */
+INA_API(size_t) ina_mem_usable_size(void *ptr);
+
 
 /*
  * The function returns the number of bytes in a memory page, where "page" is 
@@ -86,7 +149,10 @@ INA_INLINE size_t ina_mem_get_aligned_size(size_t query)
 
 /*
  * Allocate aligned memory block. Allocates a block of size bytes of memory,
- * returning a pointer to the beginning of the block.
+ * returning a pointer to the beginning of the block. The block is allocated
+ * natively aligned (posix_memalign) and must be released with
+ * ina_mem_free_aligned(). Large blocks (256 KB by default) are mapped page
+ * granular from the operating system instead.
  *
  * The content of the newly allocated block of memory is not initialized,
  * remaining with indeterminate values.
@@ -95,7 +161,7 @@ INA_INLINE size_t ina_mem_get_aligned_size(size_t query)
  * pointer shall not be used to dereference an object in any case.
  *
  * Parameters
- * alignment  Memory alignment in bytes
+ * alignment  Memory alignment in bytes, a power of two
  * size       Size of the memory block, in bytes. size_t is an unsigned integral
  *            type.
  *
@@ -129,10 +195,22 @@ INA_API(void*) ina_mem_alloc_aligned(size_t alignment, size_t size);
  *  If the function failed to allocate the requested block of memory,
  *  a null pointer is returned.
  */
-INA_INLINE void * ina_mem_alloc(size_t size)
-{
-    return ina_mem_alloc_aligned(sizeof(void*), size);
-}
+INA_API(void*) ina_mem_alloc(size_t size);
+
+/*
+ * Allocate zero initialized memory block. Large blocks are taken from fresh
+ * pages of the operating system, which are already zero filled, so no
+ * additional memset is needed.
+ *
+ * Parameters
+ * size  Size of the memory block, in bytes.
+ *
+ * Return
+ *  On success, a pointer to the memory block allocated by the function.
+ *  If the function failed to allocate the requested block of memory,
+ *  a null pointer is returned.
+ */
+INA_API(void*) ina_mem_calloc(size_t size);
 
 /*
  * Attempts to resize the memory block pointed to by ptr that was previously
@@ -152,6 +230,23 @@ INA_INLINE void * ina_mem_alloc(size_t size)
  */
 INA_API(void*) ina_mem_realloc(void *ptr, size_t nb);
 
+/*
+ * Resize a memory block allocated by ina_mem_alloc_aligned(), the block keeps
+ * its alignment. Mapped blocks are remapped, in place if possible.
+ *
+ * Parameters
+ *  ptr        Pointer to a memory block previously allocated with
+ *             ina_mem_alloc_aligned(), NULL allocates a new block.
+ *  alignment  Memory alignment in bytes, a power of two
+ *  nb         New size of the memory block in bytes. If 0 the memory block is
+ *             released and a NULL pointer is returned.
+ *
+ * Return
+ *  Pointer to the resized memory block, or NULL if the request fails. The old
+ *  block stays valid if the request fails.
+ */
+INA_API(void*) ina_mem_realloc_aligned(void *ptr, size_t alignment, size_t nb);
+
 /*
  * Move a memory block.
  *
@@ -220,6 +315,36 @@ INA_INLINE void * ina_mem_cpy(void *dest, const void *src, size_t nb)
 	return INA_MEM_MEMCPY(dest, src, nb);
 }
 
+/*
+ * Fill a block of memory with streaming (non-temporal) stores, which bypass
+ * the caches. For large blocks that are not read soon, e.g. clearing chunks,
+ * the working set stays in the cache. The fastest variant for the CPU (AVX2,
+ * SSE2) is selected on first use, small blocks are filled by ina_mem_set().
+ *
+ * Parameters
+ *  dest   Pointer to the block of memory to fill.
+ *  value  Value to be set, converted to unsigned char.
+ *  nb     Number of bytes to be set to the value.
+ *
+ * Return
+ *  dest is returned.
+ */
+INA_API(void*) ina_mem_set_nt(void *dest, int value, size_t nb);
+
+/*
+ * Copy a block of memory with streaming (non-temporal) stores, see
+ * ina_mem_set_nt(). The blocks must not overlap.
+ *
+ * Parameters
+ *  dest  Pointer to the destination array.
+ *  src   Pointer to the source of data to be copied.
+ *  nb    Number of bytes to copy.
+ *
+ * Return
+ *  dest is returned.
+ */
+INA_API(void*) ina_mem_cpy_nt(void *dest, const void *src, size_t nb);
+
 /*
  * Compare two blocks of memory
  *
@@ -313,11 +438,16 @@ INA_INLINE void* ina_mem_set(void *dest, int value, size_t nb)
  * Parameters
  * ptr   pointer to a memory block previously allocated with ina_mem_alloc()
  */
+INA_API(void) ina_mem_free(void *ptr);
 
-INA_INLINE void ina_mem_free(void *ptr)
-{
-	INA_MEM_FREE(*((void**)((size_t)ptr - sizeof(void*))));
-}
+/*
+ * Deallocate a memory block allocated by ina_mem_alloc_aligned() or
+ * ina_mem_realloc_aligned().
+ *
+ * Parameters
+ * ptr   pointer to a memory block, NULL is ignored
+ */
+INA_API(void) ina_mem_free_aligned(void *ptr);
 
 
 #ifdef __cplusplus
@@ -29,7 +29,7 @@ extern "C" {
 #define INA_MEM_BESTFIT         (4)
 /* Child pool (internal used) */
 #define INA_MEM_CHILD           (8)
-/* Use shared memory */
+/* Use shared memory, attached processes allocate from a common cursor */
 #define INA_MEM_SHARED          (32)
 /* Open or create shared memory */
 #define INA_MEM_SHARED_CREATE   (64)
@@ -37,12 +37,68 @@ extern "C" {
 #define INA_MEM_SHARED_OWNER    (128)
 /* Open shared memory exclusive */
 #define INA_MEM_SHARED_EXCL    (256)
-/* Do not fill zero on creation */
+/* Do not fill zero on creation (zero filled chunks come from calloc) */
 #define INA_MEM_NOZEROFILL     (512)
+/* Per thread chunks, allocations are thread safe (implies dynamic) */
+#define INA_MEM_THREADLOCAL    (1024)
+/* Back chunks by anonymous memory mappings */
+#define INA_MEM_MMAP           (2048)
+/* Back chunks by transparent huge pages (implies INA_MEM_MMAP) */
+#define INA_MEM_HUGEPAGE       (4096)
+
+/* Align all allocations to INA_MEM_CACHELINE_SIZE */
+#define INA_MEM_CACHEALIGN     (8192)
+/* Map the file named by the label as fixed size pool, created if missing */
+#define INA_MEM_FILE           (16384)
+/*
+ * Debug mode, allocations of at least INA_MEM_GUARD_SIZE end at an
+ * inaccessible page, freed and reset memory is poisoned and not reused.
+ * Set for all pools if the environment variable INA_MEM_GUARD is set (and not
+ * 0) when the library is initialized.
+ */
+#define INA_MEM_GUARD          (32768)
+/*
+ * Back chunks by anonymous memory files, enables ina_mempool_snapshot()
+ * (Linux only, implies INA_MEM_MMAP)
+ */
+#define INA_MEM_SNAPSHOT       (65536)
+
+/* Minimal allocation size placed in front of a guard page */
+#define INA_MEM_GUARD_SIZE (4096)
+
+/* NUMA nodes, see ina_mempool_set_node() */
+#define INA_MEM_NODE_ANY   (-1)
+#define INA_MEM_NODE_LOCAL (-2)
+#define INA_MEM_MAX_NODES  (1024)
+
+/* Huge page size used to align INA_MEM_HUGEPAGE chunks */
+#define INA_MEM_HUGEPAGE_SIZE (2*1024*1024)
 
 /* Opaque emory pool handle */
 typedef struct ina_mempool_s ina_mempool_t;
 
+/*
+ * Called before a pool would grow beyond its limit. size is the number of
+ * bytes the pool is about to add, pool is NULL if a new pool is created. Return
+ * INA_SUCCESS after memory was given back (e.g. by ina_mempool_shrink() of
+ * another pool) or the limit was raised to retry, otherwise the allocation
+ * fails with INA_ERR_POOL_LIMIT.
+ */
+typedef ina_rc_t (*ina_mempool_limit_fn_t)(ina_mempool_t *pool, size_t size,
+                                           void *arg);
+
+/* Pool checkpoint returned by ina_mempool_mark(), members are private */
+typedef struct ina_mempool_mark_s {
+    ina_mempool_t *chunk;
+    ina_mempool_t *live;
+    size_t pos;
+    size_t end;
+    size_t barrier;
+    ina_mempool_t *outer;
+    size_t outer_pos;
+    void *bins;
+} ina_mempool_mark_t;
+
 /* struct to hold pool information */
 typedef struct ina_mempool_info_s {
     uint32_t cf;       /* creation flags */
@@ -50,8 +106,25 @@ typedef struct ina_mempool_info_s {
     size_t used;       /* current used size incl. all chunks */
     size_t children;   /* number of chunks */
     size_t chunk_size; /* default chunks size */
+    int node;          /* NUMA node of new chunks, see ina_mempool_set_node() */
 } ina_mempool_info_t;
 
+/* Chunk of a pool snapshot */
+typedef struct ina_mempool_snapshot_chunk_s {
+    const unsigned char *data; /* read-only view of the chunk */
+    const unsigned char *base; /* address of the chunk in the pool */
+    size_t size;               /* size of the chunk */
+    size_t pos;                /* end of the ina_mempool_dalloc() area */
+    size_t end;                /* start of the ina_mempool_nalloc() area */
+} ina_mempool_snapshot_chunk_t;
+
+/* Snapshot returned by ina_mempool_snapshot() */
+typedef struct ina_mempool_snapshot_s {
+    ina_mempool_t *pool;       /* NULL after the pool was freed */
+    size_t nchunks;
+    ina_mempool_snapshot_chunk_t *chunks;
+} ina_mempool_snapshot_t;
+
 /*
  * Initialized memory pool module
  *
@@ -83,9 +156,11 @@ INA_API(ina_rc_t) ina_mempool_info(ina_mempool_t *pool,
  *
  * Parameters
  *  pool     Pointer to a memory pool pointer
- *  size     Size of memory pool in bytes.
+ *  size     Size of memory pool in bytes. The size of an existing file is
+ *           used for INA_MEM_FILE pools.
  *  cf       Creation flags
- *  label    Pool label. Optional for non shared memory pools.
+ *  label    Pool label. Optional for non shared memory pools, the file path
+ *           for INA_MEM_FILE pools.
  *
  * Return
  *  INA_SUCCESS if pool was created successfully.
@@ -110,12 +185,13 @@ INA_API(void) ina_mempool_free(ina_mempool_t **pool);
  *
  * Return
  *  INA_SUCCESS if all went well
- *  INA_EOP     if trying to merge shared memory pool
+ *  INA_EOP     if trying to merge shared or thread local memory pools
  */
 INA_API(ina_rc_t) ina_mempool_merge(ina_mempool_t *dest, ina_mempool_t *src);
 
 /*
- * Shrink a memory pool.
+ * Shrink a memory pool. Chunks beyond the given number are released and the
+ * pool is reset.
  *
  * Parameters
  *  pool    Memory too to shrink
@@ -130,7 +206,8 @@ INA_API(ina_rc_t) ina_mempool_shrink(ina_mempool_t *pool,
                                      ina_mempool_info_t *info);
 
 /*
- * Clear a memory pool, fill all chunks with 0.
+ * Clear a memory pool, fill all chunks with 0. Only the area used since the
+ * chunk was last zero filled is written.
  *
  * Parameters
  *  pool  Memory pool to clear.
@@ -141,7 +218,10 @@ INA_API(ina_rc_t) ina_mempool_shrink(ina_mempool_t *pool,
 INA_API(ina_rc_t) ina_mempool_clear(ina_mempool_t *pool);
 
 /*
- * Reset a memory pool.
+ * Reset a memory pool. Chunks owned by threads of a INA_MEM_THREADLOCAL pool
+ * are returned to the pool. Used pages of INA_MEM_MMAP chunks are returned
+ * to the kernel (MADV_DONTNEED). Must not be called concurrently with
+ * allocations.
  *
  * Parameters
  *  pool  Memory pool to reset.
@@ -152,7 +232,217 @@ INA_API(ina_rc_t) ina_mempool_clear(ina_mempool_t *pool);
 INA_API(ina_rc_t) ina_mempool_reset(ina_mempool_t *pool);
 
 /*
- * Allocate reallocable memory from a pool.
+ * Write the allocation state and all data of a INA_MEM_FILE pool to its file.
+ * Without sync the data is written back by the operating system after the
+ * pool is freed. A file pool must not be opened by several pools at once.
+ *
+ * Parameters
+ *  pool  File backed memory pool
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ *  INA_EOP     if the pool is not file backed
+ */
+INA_API(ina_rc_t) ina_mempool_sync(ina_mempool_t *pool);
+
+/*
+ * Store the root object of a INA_MEM_FILE pool, the entry point to the data
+ * after the file is reopened. Reset and clear drop the root.
+ *
+ * Parameters
+ *  pool  File backed memory pool
+ *  root  Memory allocated from the pool, NULL to drop the root
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ *  INA_EOP     if the pool is not file backed
+ */
+INA_API(ina_rc_t) ina_mempool_set_root(ina_mempool_t *pool, void *root);
+
+/*
+ * Get the root object of a INA_MEM_FILE pool.
+ *
+ * Parameters
+ *  pool  File backed memory pool
+ *
+ * Return
+ *  Root object, NULL if none was set
+ */
+INA_API(void *) ina_mempool_get_root(ina_mempool_t *pool);
+
+/*
+ * Convert memory of a INA_MEM_FILE or INA_MEM_SHARED pool to its offset in the
+ * pool. Offsets stay valid when the memory is mapped at another address (on
+ * reopen or by another process), store them instead of pointers.
+ *
+ * Parameters
+ *  pool  Memory pool
+ *  ptr   Memory allocated from pool, may be NULL
+ *
+ * Return
+ *  Offset, 0 for NULL
+ */
+INA_API(size_t) ina_mempool_ptr2off(ina_mempool_t *pool, const void *ptr);
+
+/*
+ * Convert an offset returned by ina_mempool_ptr2off() to memory of the pool.
+ *
+ * Parameters
+ *  pool  Memory pool
+ *  off   Offset
+ *
+ * Return
+ *  Pointer to the memory, NULL for offset 0
+ */
+INA_API(void *) ina_mempool_off2ptr(ina_mempool_t *pool, size_t off);
+
+/*
+ * Place the chunks of a pool on a NUMA node. Existing chunks are moved, new
+ * chunks are mapped (INA_MEM_MMAP) and bound before they are touched.
+ * Linux only.
+ *
+ * Parameters
+ *  pool  Memory pool, not shared or file backed
+ *  node  NUMA node, INA_MEM_NODE_LOCAL for the node of the thread creating a
+ *        chunk (preferred, other nodes are used if it is full) or
+ *        INA_MEM_NODE_ANY to stop binding new chunks
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ *  INA_EOP     if not supported by the system
+ */
+INA_API(ina_rc_t) ina_mempool_set_node(ina_mempool_t *pool, int node);
+
+/*
+ * Get the memory of a pool resident on each NUMA node. Linux only.
+ *
+ * Parameters
+ *  pool   Memory pool
+ *  usage  Array of nodes counters, receives the resident bytes per node
+ *  nodes  Number of counters
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ *  INA_EOP     if not supported by the system
+ */
+INA_API(ina_rc_t) ina_mempool_node_usage(ina_mempool_t *pool, size_t *usage,
+                                         size_t nodes);
+
+/*
+ * Limit the size of all chunks of a pool. The limit is checked before a chunk
+ * is added, the callback runs once per crossing with the lock of a thread
+ * local pool held and must not allocate from the same pool. Chunks merged into
+ * the pool are not checked.
+ *
+ * Parameters
+ *  pool      Memory pool
+ *  limit     Limit in bytes, 0 for no limit
+ *  limit_fn  Optional. Callback invoked before the limit is crossed
+ *  arg       Argument passed to the callback
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_mempool_set_limit(ina_mempool_t *pool, size_t limit,
+                                        ina_mempool_limit_fn_t limit_fn,
+                                        void *arg);
+
+/*
+ * Limit the size of all chunks of all pools of the process. The limit is
+ * checked before a pool or chunk is created, concurrent threads may exceed it
+ * by the chunks they are creating at the same time.
+ *
+ * Parameters
+ *  limit     Limit in bytes, 0 for no limit
+ *  limit_fn  Optional. Callback invoked before the limit is crossed
+ *  arg       Argument passed to the callback
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_mempool_set_global_limit(size_t limit,
+                                               ina_mempool_limit_fn_t limit_fn,
+                                               void *arg);
+
+/*
+ * Set a checkpoint in a memory pool. All memory allocated after the mark can
+ * be given back at once by ina_mempool_release(). Marks can be nested, while
+ * a mark is set only chunks created after it are reused for allocations and
+ * ina_mempool_dfree() recycles only blocks allocated after it, blocks before
+ * the mark stay allocated. Shared and thread local pools do not support marks.
+ *
+ * Parameters
+ *  pool  Memory pool
+ *
+ * Return
+ *  Checkpoint to pass to ina_mempool_release()
+ */
+INA_API(ina_mempool_mark_t) ina_mempool_mark(ina_mempool_t *pool);
+
+/*
+ * Release all memory allocated after a checkpoint, inner marks set after it
+ * are released as well. Chunks added after the mark are kept for reuse, free
+ * lists of ina_mempool_dfree() are restored to their state at the mark. A
+ * mark becomes invalid by reset, clear, shrink or release of an outer mark.
+ *
+ * Parameters
+ *  pool  Memory pool
+ *  mark  Checkpoint returned by ina_mempool_mark()
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ *  INA_EOP     if the pool does not support marks
+ */
+INA_API(ina_rc_t) ina_mempool_release(ina_mempool_t *pool,
+                                      ina_mempool_mark_t mark);
+
+/*
+ * Take a copy-on-write snapshot of a INA_MEM_SNAPSHOT pool. The snapshot is a
+ * read-only view of all chunks at the time of the call, e.g. for another
+ * thread to serialize, while the pool is used and written on. Pages are only
+ * copied when they are written to. A pool has one snapshot at a time.
+ *
+ * Parameters
+ *  pool  Memory pool
+ *  snap  Pointer to a snapshot pointer
+ *
+ * Return
+ *  INA_SUCCESS if the snapshot was taken
+ *  INA_EOP if the pool is no INA_MEM_SNAPSHOT pool or has a snapshot
+ */
+INA_API(ina_rc_t) ina_mempool_snapshot(ina_mempool_t *pool,
+                                       ina_mempool_snapshot_t **snap);
+
+/*
+ * Translate the address of a pool allocation into a snapshot.
+ *
+ * Parameters
+ *  snap  Snapshot
+ *  ptr   Pointer into the pool
+ *
+ * Return
+ *  Address of ptr in the view, NULL if ptr was not in the pool when the
+ *  snapshot was taken
+ */
+INA_API(const void *) ina_mempool_snapshot_ptr(const ina_mempool_snapshot_t *snap,
+                                               const void *ptr);
+
+/*
+ * Free a snapshot. Changes made since the snapshot are written back to the
+ * chunks, the snapshot must be freed by the thread using the pool.
+ *
+ * Parameters
+ *  snap  Pointer to a snapshot pointer
+ */
+INA_API(void) ina_mempool_snapshot_free(ina_mempool_snapshot_t **snap);
+
+/*
+ * Allocate reallocable memory from a pool. For INA_MEM_THREADLOCAL pools each
+ * calling thread allocates from its own chunk without locking, a thread that
+ * uses more pools than its cache holds locks a chunk shared by such threads.
+ * INA_MEM_SHARED pools advance a cursor stored in the shared segment
+ * atomically, so several processes can allocate from the same segment
+ * concurrently.
  *
  * Parameters
  *  pool  Memory pool
@@ -165,6 +455,38 @@ INA_API(ina_rc_t) ina_mempool_reset(ina_mempool_t *pool);
  */
 INA_API(void *)  ina_mempool_dalloc(ina_mempool_t *pool, size_t size);
 
+/*
+ * Allocate memory from a pool at the given alignment. The alignment is not
+ * preserved if the block is moved by ina_mempool_ralloc().
+ *
+ * Parameters
+ *  pool       Memory pool
+ *  size       Number of bytes to allocate
+ *  alignment  Alignment in bytes, must be a power of two (e.g.
+ *             INA_MEM_CACHELINE_SIZE)
+ *
+ * Return
+ *   Pointer to the allocated memory aligned to alignment
+ */
+INA_API(void *) ina_mempool_dalloc_aligned(ina_mempool_t *pool, size_t size,
+                                           size_t alignment);
+
+/*
+ * Give memory allocated by ina_mempool_dalloc() back to a pool. The block is
+ * coalesced with free neighbours, kept in a size-class free list of the pool
+ * and reused by later allocations of a fitting size or grown into by
+ * ina_mempool_ralloc(). Free lists are dropped on reset, clear and
+ * shrink. Blocks allocated before a mark stay allocated until the mark is
+ * released. Blocks of shared or thread local pools are not recycled, blocks of
+ * INA_MEM_GUARD pools are poisoned or made inaccessible.
+ *
+ * Parameters
+ *  pool  Memory pool
+ *  ptr   Pointer returned by ina_mempool_dalloc(), NULL is ignored
+ *  size  Size passed to ina_mempool_dalloc()
+ */
+INA_API(void) ina_mempool_dfree(ina_mempool_t *pool, void *ptr, size_t size);
+
 /*
  * Allocate not reallocable memory from a pool.
  *
@@ -180,7 +502,10 @@ INA_API(void *)  ina_mempool_dalloc(ina_mempool_t *pool, size_t size);
 INA_API(void *)  ina_mempool_nalloc(ina_mempool_t *pool, size_t size);
 
 /*
- * Reallocate memory from a pool
+ * Reallocate memory from a pool. The block grows in place at the end of the
+ * current chunk or into a free block behind it, a shrunk block gives its
+ * tail to the free lists. A moved block is given back like by
+ * ina_mempool_dfree() and must not be used anymore.
  *
  * Parameters
  *  pool      Memory pool
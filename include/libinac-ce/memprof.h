@@ -0,0 +1,117 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#ifndef _LIBINAC_MEMPROF_H_
+#define _LIBINAC_MEMPROF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libinac-ce/lib.h>
+
+/*
+ * Allocation profiler. Compile with INA_MEM_PROFILE defined to route the
+ * ina_mem_* and ina_mempool_* allocation functions through the profiler,
+ * every call site (INA_AT) gets its own statistics. Without INA_MEM_PROFILE
+ * the functions are called directly.
+ */
+
+/* Number of log2 size classes of the histogram, the last takes the rest */
+#define INA_MEM_PROFILE_HIST (32)
+
+/* Statistics of a call site */
+typedef struct ina_mem_profile_entry_s {
+    const char *at;                        /* file:line of the call site */
+    uint64_t calls;                        /* number of (re)allocations */
+    uint64_t frees;                        /* number of frees */
+    uint64_t bytes;                        /* bytes requested */
+    uint64_t hist[INA_MEM_PROFILE_HIST];   /* calls by log2 of the size */
+} ina_mem_profile_entry_t;
+
+/*
+ * Collect the statistics of all threads.
+ *
+ * Parameters
+ *  entries  Where to store the array of call sites sorted by bytes, release
+ *           with ina_mem_free().
+ *  count    Number of entries
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_mem_profile_report(ina_mem_profile_entry_t **entries,
+                                         size_t *count);
+
+/*
+ * Print the statistics of all threads sorted by bytes.
+ *
+ * Parameters
+ *  fp  Stream to print to
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_mem_profile_dump(FILE *fp);
+
+/*
+ * Reset the statistics of all threads. Counts of concurrent allocations may
+ * get lost.
+ */
+INA_API(void) ina_mem_profile_reset(void);
+
+/* Profiled allocation functions, use the macros below */
+INA_API(void*) ina_mem_profile_alloc(const char *at, size_t size);
+INA_API(void*) ina_mem_profile_calloc(const char *at, size_t size);
+INA_API(void*) ina_mem_profile_alloc_aligned(const char *at, size_t alignment,
+                                             size_t size);
+INA_API(void*) ina_mem_profile_realloc(const char *at, void *ptr, size_t nb);
+INA_API(void*) ina_mem_profile_realloc_aligned(const char *at, void *ptr,
+                                               size_t alignment, size_t nb);
+INA_API(void) ina_mem_profile_free(const char *at, void *ptr);
+INA_API(void) ina_mem_profile_free_aligned(const char *at, void *ptr);
+INA_API(void*) ina_mem_profile_dalloc(const char *at, ina_mempool_t *pool,
+                                      size_t size);
+INA_API(void*) ina_mem_profile_dalloc_aligned(const char *at,
+                                              ina_mempool_t *pool, size_t size,
+                                              size_t alignment);
+INA_API(void*) ina_mem_profile_nalloc(const char *at, ina_mempool_t *pool,
+                                      size_t size);
+INA_API(void*) ina_mem_profile_ralloc(const char *at, ina_mempool_t *pool,
+                                      void *old, size_t old_size,
+                                      size_t new_size);
+INA_API(void) ina_mem_profile_dfree(const char *at, ina_mempool_t *pool,
+                                    void *ptr, size_t size);
+
+#if defined(INA_MEM_PROFILE) && !defined(INA_MEM_PROFILE_IMPL)
+#define ina_mem_alloc(size) ina_mem_profile_alloc(INA_AT, size)
+#define ina_mem_calloc(size) ina_mem_profile_calloc(INA_AT, size)
+#define ina_mem_alloc_aligned(alignment, size) \
+    ina_mem_profile_alloc_aligned(INA_AT, alignment, size)
+#define ina_mem_realloc(ptr, nb) ina_mem_profile_realloc(INA_AT, ptr, nb)
+#define ina_mem_realloc_aligned(ptr, alignment, nb) \
+    ina_mem_profile_realloc_aligned(INA_AT, ptr, alignment, nb)
+#define ina_mem_free(ptr) ina_mem_profile_free(INA_AT, ptr)
+#define ina_mem_free_aligned(ptr) ina_mem_profile_free_aligned(INA_AT, ptr)
+#define ina_mempool_dalloc(pool, size) \
+    ina_mem_profile_dalloc(INA_AT, pool, size)
+#define ina_mempool_dalloc_aligned(pool, size, alignment) \
+    ina_mem_profile_dalloc_aligned(INA_AT, pool, size, alignment)
+#define ina_mempool_nalloc(pool, size) \
+    ina_mem_profile_nalloc(INA_AT, pool, size)
+#define ina_mempool_ralloc(pool, old, old_size, new_size) \
+    ina_mem_profile_ralloc(INA_AT, pool, old, old_size, new_size)
+#define ina_mempool_dfree(pool, ptr, size) \
+    ina_mem_profile_dfree(INA_AT, pool, ptr, size)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1109,11 +1109,23 @@ INA_API(int) gettimeofday(struct timeval *tv, struct timezone *tz);
 #ifdef INA_OS_WIN32
 #define INA_ATOMIC_INC(vv_ptr) InterlockedIncrement64(vv_ptr)
 #define INA_ATOMIC_DEC(vv_ptr) InterlockedDecrement64(vv_ptr)
+#define INA_ATOMIC_ADD(vv_ptr,v) InterlockedExchangeAdd64(vv_ptr,v)
 #define INA_ATOMIC_SWAP(vv_ptr,old,new) InterlockedCompareExchange64(vv_ptr,new,old)
+#define INA_ATOMIC_LOAD(vv_ptr) InterlockedCompareExchange64(vv_ptr,0,0)
+#define INA_ATOMIC_STORE(vv_ptr,v) InterlockedExchange64(vv_ptr,v)
 #elif defined(__GNUC__) && ( __GNUC__ * 100 + __GNUC_MINOR__ >= 401 )
 #define INA_ATOMIC_INC(vv_ptr) __sync_fetch_and_add(vv_ptr, 1)
 #define INA_ATOMIC_DEC(vv_ptr) __sync_fetch_and_sub(vv_ptr, 1)
+#define INA_ATOMIC_ADD(vv_ptr,v) __sync_fetch_and_add(vv_ptr, v)
 #define INA_ATOMIC_SWAP(vv_ptr,old,new) __sync_val_compare_and_swap(vv_ptr,old,new)
+/* Load with acquire, store with release semantics */
+#if defined(__ATOMIC_ACQUIRE)
+#define INA_ATOMIC_LOAD(vv_ptr) __atomic_load_n(vv_ptr, __ATOMIC_ACQUIRE)
+#define INA_ATOMIC_STORE(vv_ptr,v) __atomic_store_n(vv_ptr, v, __ATOMIC_RELEASE)
+#else
+#define INA_ATOMIC_LOAD(vv_ptr) __sync_fetch_and_add(vv_ptr, 0)
+#define INA_ATOMIC_STORE(vv_ptr,v) do { __sync_synchronize(); *(vv_ptr) = (v); } while (0)
+#endif
 #else
 #error Compiler not supported yet for INAC!
 #endif
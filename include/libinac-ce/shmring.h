@@ -0,0 +1,136 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#ifndef _LIBINAC_SHMRING_H_
+#define _LIBINAC_SHMRING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libinac-ce/lib.h>
+
+/* Single producer, single consumer */
+#define INA_SHMRING_SPSC     (0)
+/* Several producers and consumers */
+#define INA_SHMRING_MPMC     (1)
+/* Enable ina_shmring_wait_push() and ina_shmring_wait_pop() */
+#define INA_SHMRING_BLOCKING (2)
+
+/*
+ * Lock-free ring buffer of fixed size items. The ring lives in the memory of
+ * the pool it was created from and holds no pointers, created in a
+ * INA_MEM_SHARED pool it connects all processes attached to the pool.
+ */
+typedef struct ina_shmring_s ina_shmring_t;
+
+/*
+ * Create a ring buffer in a memory pool. The ring is released with the pool.
+ * Pass ina_mempool_ptr2off() of the ring to other processes to attach it.
+ *
+ * Parameters
+ *  pool       Memory pool, usually a INA_MEM_SHARED pool
+ *  item_size  Size of an item in bytes
+ *  capacity   Number of items, rounded up to a power of two
+ *  cf         Creation flags, INA_SHMRING_SPSC or INA_SHMRING_MPMC, optionally
+ *             or'ed with INA_SHMRING_BLOCKING
+ *  ring       Pointer to a ring pointer
+ *
+ * Return
+ *  INA_SUCCESS if the ring was created successfully.
+ */
+INA_API(ina_rc_t) ina_shmring_new(ina_mempool_t *pool, size_t item_size,
+                                  size_t capacity, uint32_t cf,
+                                  ina_shmring_t **ring);
+
+/*
+ * Attach a ring buffer created by another process.
+ *
+ * Parameters
+ *  pool  Memory pool the ring was created in
+ *  off   Offset of the ring in the pool, see ina_mempool_ptr2off()
+ *  ring  Pointer to a ring pointer
+ *
+ * Return
+ *  INA_SUCCESS if the ring was attached successfully.
+ */
+INA_API(ina_rc_t) ina_shmring_attach(ina_mempool_t *pool, size_t off,
+                                     ina_shmring_t **ring);
+
+/*
+ * Append items to a ring buffer without blocking.
+ *
+ * Parameters
+ *  ring   Ring buffer
+ *  items  Array of count items
+ *  count  Number of items
+ *
+ * Return
+ *  Number of items appended, less than count if the ring is full
+ */
+INA_API(size_t) ina_shmring_push(ina_shmring_t *ring, const void *items,
+                                 size_t count);
+
+/*
+ * Take items from a ring buffer without blocking.
+ *
+ * Parameters
+ *  ring   Ring buffer
+ *  items  Array for count items
+ *  count  Number of items
+ *
+ * Return
+ *  Number of items taken, less than count if the ring ran empty
+ */
+INA_API(size_t) ina_shmring_pop(ina_shmring_t *ring, void *items,
+                                size_t count);
+
+/*
+ * Wait until a ring created with INA_SHMRING_BLOCKING has room for an item.
+ * Uses a futex on Linux, other systems poll.
+ *
+ * Parameters
+ *  ring     Ring buffer
+ *  timeout  Timeout in milliseconds, negative to wait forever
+ *
+ * Return
+ *  INA_SUCCESS if there is room
+ *  INA_ERR_TIMED_OUT on timeout
+ */
+INA_API(ina_rc_t) ina_shmring_wait_push(ina_shmring_t *ring, int64_t timeout);
+
+/*
+ * Wait until a ring created with INA_SHMRING_BLOCKING holds an item.
+ *
+ * Parameters
+ *  ring     Ring buffer
+ *  timeout  Timeout in milliseconds, negative to wait forever
+ *
+ * Return
+ *  INA_SUCCESS if there is an item
+ *  INA_ERR_TIMED_OUT on timeout
+ */
+INA_API(ina_rc_t) ina_shmring_wait_pop(ina_shmring_t *ring, int64_t timeout);
+
+/*
+ * Get the number of items in a ring buffer, a snapshot while other threads
+ * push or pop.
+ *
+ * Parameters
+ *  ring  Ring buffer
+ *
+ * Return
+ *  Number of items
+ */
+INA_API(size_t) ina_shmring_count(ina_shmring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
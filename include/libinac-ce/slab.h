@@ -0,0 +1,143 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#ifndef _LIBINAC_SLAB_H_
+#define _LIBINAC_SLAB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libinac-ce/lib.h>
+
+/* Size of a slab page, objects are carved from pages of this size */
+#define INA_SLAB_PAGE_SIZE (64*1024)
+/* Smallest page size, see ina_slab_set_page_size() */
+#define INA_SLAB_MIN_PAGE_SIZE (4*1024)
+
+/* Single threaded slab */
+#define INA_SLAB_DEFAULT    (0)
+/* Thread safe slab, threads cache objects in magazines flushed on thread exit */
+#define INA_SLAB_THREADSAFE (1)
+
+/* Opaque slab handle */
+typedef struct ina_slab_s ina_slab_t;
+
+/* struct to hold slab information */
+typedef struct ina_slab_info_s {
+    size_t obj_size;  /* effective object size */
+    size_t size;      /* size of all pages */
+    size_t used;      /* objects in use, incl. objects cached by threads */
+    size_t pages;     /* number of pages */
+} ina_slab_info_t;
+
+/*
+ * Create a slab allocator for objects of a fixed size. Freed objects are kept
+ * in intrusive free lists of their page, a page is given back as soon as all
+ * of its objects are freed (one empty page is kept as spare).
+ *
+ * Parameters
+ *  obj_size  Object size in bytes, at most a page minus its header
+ *  cf        Creation flags, INA_SLAB_DEFAULT or INA_SLAB_THREADSAFE
+ *  slab      Pointer to a slab pointer
+ *
+ * Return
+ *  INA_SUCCESS if the slab was created successfully.
+ */
+INA_API(ina_rc_t) ina_slab_new(size_t obj_size, uint32_t cf, ina_slab_t **slab);
+
+/*
+ * Free a slab including all objects.
+ *
+ * Parameters
+ *  slab  Slab to free
+ */
+INA_API(void) ina_slab_free(ina_slab_t **slab);
+
+/*
+ * Allocate an object.
+ *
+ * Parameters
+ *  slab  Slab
+ *
+ * Return
+ *  Pointer to the object aligned for any kind of variable, NULL if out of
+ *  memory.
+ */
+INA_API(void *) ina_slab_alloc(ina_slab_t *slab);
+
+/*
+ * Give an object back to its slab.
+ *
+ * Parameters
+ *  slab  Slab the object was allocated from
+ *  ptr   Object, NULL is ignored
+ */
+INA_API(void) ina_slab_dealloc(ina_slab_t *slab, void *ptr);
+
+/*
+ * Allocate pages in advance, so that at least count objects can be allocated
+ * without further page allocations.
+ *
+ * Parameters
+ *  slab   Slab
+ *  count  Number of objects
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_slab_reserve(ina_slab_t *slab, size_t count);
+
+/*
+ * Set the page size of a slab that has no pages yet, slabs holding few
+ * objects waste less memory with smaller pages.
+ *
+ * Parameters
+ *  slab       Slab
+ *  page_size  Power of two from INA_SLAB_MIN_PAGE_SIZE to INA_SLAB_PAGE_SIZE
+ *             that holds at least one object
+ *
+ * Return
+ *  INA_SUCCESS if the page size was set
+ *  INA_EOP     if the slab has pages
+ */
+INA_API(ina_rc_t) ina_slab_set_page_size(ina_slab_t *slab, size_t page_size);
+
+/*
+ * Move all pages of src into dest, objects of src belong to dest afterwards.
+ * src stays valid and empty. Objects of a INA_SLAB_THREADSAFE src that other
+ * threads keep in their magazines are not reused, they are given back with
+ * the pages of dest.
+ *
+ * Parameters
+ *  dest  Destination
+ *  src   Source, a slab of the same object size
+ *
+ * Return
+ *  INA_SUCCESS if all went well
+ *  INA_EOP     if the object or page sizes differ
+ */
+INA_API(ina_rc_t) ina_slab_merge(ina_slab_t *dest, ina_slab_t *src);
+
+/*
+ * Get runtime information about a slab.
+ *
+ * Parameters
+ *  slab  Slab
+ *  info  Pointer to slab information structure.
+ *
+ * Return
+ *  INA_SUCCESS if no error occurred.
+ */
+INA_API(ina_rc_t) ina_slab_info(ina_slab_t *slab, ina_slab_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -333,7 +333,8 @@ INA_INLINE const char* ina_str_rchr(ina_cstr_t str, const char chr)
  *  n     Maximum number of characters to copy
  *
  * Return
- *  dest
+ *  dest or its new location, NULL if dest has to grow and no memory is left
+ *  or dest was allocated from a pool. dest is unchanged then.
  */
 INA_API(ina_str_t) ina_str_ncpy(ina_str_t dest, ina_cstr_t src, size_t n);
 
@@ -364,7 +365,8 @@ INA_INLINE ina_str_t ina_str_cpy(ina_str_t dest, ina_cstr_t src)
  *  n     Maximum number of characters to copy
  *
  * Return
- *  dest
+ *  dest or its new location, NULL if dest has to grow and no memory is left
+ *  or dest was allocated from a pool. dest is unchanged then.
  */
 INA_API(ina_str_t) ina_str_ncat(ina_str_t dest, ina_cstr_t src, size_t n);
 /*
@@ -379,7 +381,8 @@ INA_API(ina_str_t) ina_str_ncat(ina_str_t dest, ina_cstr_t src, size_t n);
  *  pool  Memory pool
  *
  * Return
- *  dest
+ *  dest or its new location, NULL if no memory is left. dest is unchanged
+ *  then.
  */
 INA_API(ina_str_t) ina_str_ncat_using_pool(ina_str_t dest,
                                            ina_cstr_t src,
@@ -396,7 +399,8 @@ INA_API(ina_str_t) ina_str_ncat_using_pool(ina_str_t dest,
  *  n     Maximum number of characters to copy
  *
  * Return
- *  dest
+ *  dest or its new location, NULL if dest has to grow and no memory is left
+ *  or dest was allocated from a pool. dest is unchanged then.
  */
 INA_API(ina_str_t) ina_str_ncatcstr(ina_str_t dest, const char *src, size_t n);
 
@@ -412,7 +416,8 @@ INA_API(ina_str_t) ina_str_ncatcstr(ina_str_t dest, const char *src, size_t n);
  *  pool  Memory pool
  *
  * Return
- *  dest
+ *  dest or its new location, NULL if no memory is left. dest is unchanged
+ *  then.
  */
 INA_API(ina_str_t) ina_str_ncatcstr_using_pool(ina_str_t dest,
                                                const char *src,
@@ -487,6 +492,51 @@ INA_INLINE ina_str_t ina_str_catcstr_using_pool(ina_str_t dest, const char *src,
     return ina_str_ncatcstr_using_pool(dest, src, strlen(src), pool);
 }
 
+/*
+ * Make room for a string of len characters, e.g. before appending when the
+ * final length is known. The string may be moved.
+ *
+ * Parameters
+ *  str  String
+ *  len  Length the string should hold without growing
+ *
+ * Return
+ *  str or its new location, NULL if no memory is left or str was allocated
+ *  from a pool. str is unchanged then.
+ */
+INA_API(ina_str_t) ina_str_reserve(ina_str_t str, size_t len);
+
+/*
+ * Make room for a string of len characters in a string allocated from a
+ * memory pool.
+ *
+ * Parameters
+ *  str   String
+ *  len   Length the string should hold without growing
+ *  pool  Memory pool of the string
+ *
+ * Return
+ *  str or its new location, NULL if no memory is left. str is unchanged
+ *  then.
+ */
+INA_API(ina_str_t) ina_str_reserve_using_pool(ina_str_t str, size_t len,
+                                              ina_mempool_t *pool);
+
+/*
+ * Set how strings grow when appending. The size is multiplied by factor, but
+ * at most max bytes are added ahead of the required size. The defaults are
+ * INA_STR_GROWTH_FACTOR and INA_STR_GROWTH_MAX (config.h).
+ *
+ * Parameters
+ *  factor  Growth factor, 1.0 grows to the exact size
+ *  max     Maximal number of bytes to grow ahead, 0 for no limit
+ *
+ * Return
+ *  INA_SUCCESS
+ *  INA_ERR_INVALID_ARGUMENT if factor is less than 1.0
+ */
+INA_API(ina_rc_t) ina_str_set_growth(double factor, size_t max);
+
 
 /*
  * Perform a zero copy tokenizing of a string. Bea aware, the returning string
@@ -610,8 +660,8 @@ INA_API(ina_str_t*) ina_str_split(const char *str,
 INA_API(ina_rc_t)  ina_str_split_free_tokens(ina_str_t *tokens);
 
 /*
- * Assign a empty buffer to a string. The buffer must at least have 9 bytes in
- * order to be assignable.
+ * Assign a empty buffer to a string. The buffer must at least have 4 bytes in
+ * order to be assignable, the string header takes 3 bytes of small buffers.
  *
  * Parameter
  *  buf  buffer to be assigned
@@ -720,6 +770,223 @@ INA_API(int) ina_str_vsnprintf(ina_str_t *str, size_t len, const char* fmt,
 INA_API(ina_rc_t) ina_str_wildcard_match(ina_cstr_t tame,
                                          const char *wildcard);
 
+/*
+ * String views
+ */
+
+/*
+ * Non-owning view of len characters at ptr. A view is not null-terminated
+ * and only valid as long as the viewed memory.
+ */
+typedef struct ina_strview_s {
+    const char *ptr;
+    size_t len;
+} ina_strview_t;
+
+/*
+ * View of a memory block.
+ *
+ * Parameters
+ *  blk  Memory block
+ *  len  Length of the block
+ *
+ * Return
+ *  View of blk
+ */
+INA_INLINE ina_strview_t ina_strview_fromblk(const void *blk, size_t len)
+{
+    ina_strview_t view;
+
+    view.ptr = (const char*)blk;
+    view.len = blk != NULL ? len : 0;
+    return view;
+}
+
+/*
+ * View of a C string.
+ *
+ * Parameters
+ *  cstr  C string
+ *
+ * Return
+ *  View of cstr
+ */
+INA_INLINE ina_strview_t ina_strview_fromcstr(const char *cstr)
+{
+    return ina_strview_fromblk(cstr, cstr != NULL ? strlen(cstr) : 0);
+}
+
+/*
+ * View of a string.
+ *
+ * Parameters
+ *  str  String
+ *
+ * Return
+ *  View of str
+ */
+INA_INLINE ina_strview_t ina_strview(ina_cstr_t str)
+{
+    return ina_strview_fromblk(str, ina_str_len(str));
+}
+
+/*
+ * Copy a view into a new string, e.g. when it must outlive the viewed memory.
+ *
+ * Parameters
+ *  view  View
+ *
+ * Return
+ *  New created string or NULL if an error occurred.
+ */
+INA_API(ina_str_t) ina_strview_to_str(ina_strview_t view);
+
+/*
+ * Copy a view into a new string allocated from a memory pool.
+ *
+ * Parameters
+ *  view  View
+ *  pool  Memory pool
+ *
+ * Return
+ *  New created string or NULL if an error occurred.
+ */
+INA_API(ina_str_t) ina_strview_to_str_using_pool(ina_strview_t view,
+                                                 ina_mempool_t *pool);
+
+/*
+ * Compare two views lexicographically.
+ *
+ * Parameters
+ *  lhs, rhs  Views to compare
+ *
+ * Return
+ *  Negative value if lhs is less than rhs.
+ *  0 if lhs is equal to rhs.
+ *  Positive value if lhs is greater than rhs.
+ */
+INA_API(int) ina_strview_cmp(ina_strview_t lhs, ina_strview_t rhs);
+
+/*
+ * Locate a sequence of characters in a view.
+ *
+ * Parameters
+ *  view    View to be scanned
+ *  needle  Sequence of characters to match
+ *
+ * Return
+ *  A pointer to the first occurrence of needle in view or NULL if needle is
+ *  empty or not found.
+ */
+INA_API(const char*) ina_strview_find(ina_strview_t view, ina_strview_t needle);
+
+/*
+ * Locate a character in a view.
+ *
+ * Parameters
+ *  view  View to be scanned
+ *  chr   Character to be located
+ *
+ * Return
+ *  A pointer to the first occurrence of chr in view or NULL if not found.
+ */
+INA_API(const char*) ina_strview_chr(ina_strview_t view, char chr);
+
+/*
+ * View of the characters from start until end of a view, see
+ * ina_str_substr().
+ *
+ * Parameters
+ *  view   View
+ *  start  Substring start position
+ *  end    Substring end position, inclusive
+ *
+ * Return
+ *  Substring view, empty if start is out of range
+ */
+INA_API(ina_strview_t) ina_strview_substr(ina_strview_t view, size_t start,
+                                          size_t end);
+
+/*
+ * Trim (left and right) a view.
+ *
+ * Parameters
+ *  view   View to trim
+ *  chars  Characters to trim
+ *
+ * Return
+ *  Trimmed view
+ */
+INA_API(ina_strview_t) ina_strview_trim(ina_strview_t view, const char *chars);
+
+/*
+ * Split a view by a separator into views. Adjacent separators yield empty
+ * views.
+ *
+ * Parameters
+ *  view   View to split
+ *  sep    Separator, one or more characters
+ *  count  Where to store the number of views returned
+ *
+ * Return
+ *  Array of views or NULL if view is empty or an error occurred. The array
+ *  must be freed by calling ina_mem_free().
+ */
+INA_API(ina_strview_t*) ina_strview_split(ina_strview_t view, const char *sep,
+                                          size_t *count);
+
+/*
+ * Take the next token of a view without modifying it, unlike ina_str_tok().
+ * Leading separators are skipped, the view is advanced behind the token.
+ *
+ * Parameters
+ *  view  View to tokenize, updated to the rest
+ *  sep   Separator characters
+ *  tok   Where to store the token
+ *
+ * Return
+ *  1 if a token was found, 0 if there are no more tokens
+ */
+INA_API(int) ina_strview_tok(ina_strview_t *view, const char *sep,
+                             ina_strview_t *tok);
+
+/*
+ * Iterator over the tokens of a view split by a separator, the lazy form of
+ * ina_strview_split(). It allocates nothing and does not modify the input.
+ */
+typedef struct ina_str_split_iter_s {
+    ina_strview_t rest;
+    const char *sep;
+    size_t seplen;
+    int done;
+} ina_str_split_iter_t;
+
+/*
+ * Initialize a split iterator. The input and the separator must stay valid
+ * while iterating.
+ *
+ * Parameters
+ *  iter  Iterator
+ *  view  View to split
+ *  sep   Separator, one or more characters
+ */
+INA_API(void) ina_str_split_iter_init(ina_str_split_iter_t *iter,
+                                      ina_strview_t view, const char *sep);
+
+/*
+ * Take the next token of a split iterator. Adjacent separators yield empty
+ * tokens, an empty view or separator yields none.
+ *
+ * Parameters
+ *  iter  Iterator
+ *  tok   Where to store the token
+ *
+ * Return
+ *  1 if a token was found, 0 if there are no more tokens
+ */
+INA_API(int) ina_str_split_iter_next(ina_str_split_iter_t *iter,
+                                     ina_strview_t *tok);
+
 #ifdef __cplusplus
 }
 #endif 
@@ -24,6 +24,26 @@
 #define INA_MEMPOOL_SIZE  8*1024*1024
 #endif
 
+/* Pools clear and relocate blocks of at least this size with streaming stores */
+#ifndef INA_MEM_NT_THRESHOLD
+#define INA_MEM_NT_THRESHOLD (1024*1024)
+#endif
+
+/* ina_mem_alloc_aligned() maps blocks of at least this size page granular */
+#ifndef INA_MEM_MMAP_THRESHOLD
+#define INA_MEM_MMAP_THRESHOLD (256*1024)
+#endif
+
+/* Strings grow by this factor on append, see ina_str_set_growth() */
+#ifndef INA_STR_GROWTH_FACTOR
+#define INA_STR_GROWTH_FACTOR (2.0)
+#endif
+
+/* Maximal number of bytes a string is grown ahead, 0 for no limit */
+#ifndef INA_STR_GROWTH_MAX
+#define INA_STR_GROWTH_MAX (1024*1024)
+#endif
+
 /* Define break message on assert for windows platform */
 #ifndef INA_DGBMSG_ASSERT
 #define INA_DGBMSG_ASSERT 1
@@ -9,14 +9,14 @@
 #include <libinac-ce/lib.h>
 #include "config.h"
 
+/* Node pages, the first one is allocated with the first node */
+#define __INA_LIST_PAGE_SIZE (8*1024)
+
 struct ina_list_s {
     ina_list_node_t *head;
     uint32_t cf;
     size_t count;
-    size_t max_recyclable;
-    ina_mempool_t *mp;
-    ina_list_node_t **first_free;
-    int last_free;
+    ina_slab_t *slab;
 };
 
 ina_list_node_t *__ina_split(ina_list_node_t *head)
@@ -83,11 +83,11 @@ INA_API(ina_rc_t) ina_list_new(uint32_t cf, ina_list_t **list)
     INA_RETURN_IF_NULL(*list);
     ina_mem_set(*list, 0, sizeof(ina_list_t));
     (*list)->cf = cf;
-    (*list)->max_recyclable = INA_LIST_DEFAULT_SIZE;
     if (cf&INA_LIST_CF_NOMALLOC) {
         return INA_SUCCESS;
     }
-    if (INA_FAILED(ina_list_resize(*list, INA_LIST_CF_DEFAULT, INA_LIST_DEFAULT_SIZE))) {
+    if (INA_FAILED(ina_slab_new(sizeof(ina_list_node_t), INA_SLAB_DEFAULT, &(*list)->slab)) ||
+        INA_FAILED(ina_slab_set_page_size((*list)->slab, __INA_LIST_PAGE_SIZE))) {
         ina_list_free(list);
         return ina_err_get_rc();
     }
@@ -111,8 +111,9 @@ INA_API(ina_rc_t) ina_list_new_from_hashtable(ina_hashtable_t *ht, ina_list_t **
 INA_API(void) ina_list_free(ina_list_t **list)
 {
     INA_VERIFY_FREE(list);
-    ina_mempool_free(&(*list)->mp);
-    INA_MEM_FREE_SAFE((*list)->first_free);
+    if ((*list)->slab != NULL) {
+        ina_slab_free(&(*list)->slab);
+    }
     INA_MEM_FREE_SAFE(*list);
 }
 
@@ -121,12 +122,10 @@ INA_API(ina_rc_t) ina_list_node_new(ina_list_t *list, ina_list_node_t **node)
     INA_VERIFY_NOT_NULL(list);
     INA_VERIFY_NOT_NULL(node);
 
-    if (list->last_free) {
-        *node = list->first_free[list->last_free];
-        list->last_free--;
-        return INA_SUCCESS;
+    *node = (ina_list_node_t*)ina_slab_alloc(list->slab);
+    if (*node == NULL) {
+        return ina_err_get_rc();
     }
-    *node = ina_mempool_dalloc(list->mp, sizeof(ina_list_node_t));
     return INA_SUCCESS;
 }
 
@@ -134,17 +133,15 @@ INA_API(void) ina_list_node_free(ina_list_t *list, ina_list_node_t **node)
 {
     INA_VERIFY_FREE(node);
     INA_ASSERT_NOT_NULL(list);
-    if (list->last_free < list->max_recyclable) {
-        list->last_free++;
-        list->first_free[list->last_free] = *node;
-    }
+    ina_slab_dealloc(list->slab, *node);
     *node = NULL;
 }
 
 INA_API(ina_rc_t) ina_list_resize(ina_list_t *list, size_t min_nodes, size_t max_recyclable_nodes)
 {
     INA_VERIFY_NOT_NULL(list);
-    ina_mempool_t *mp;
+    /* freed nodes are always recycled by the slab */
+    INA_UNUSED(max_recyclable_nodes);
 
     if (list->cf&INA_LIST_CF_NOMALLOC) {
         return INA_ERROR(INA_ERR_OPERATION_INVALID);
@@ -157,43 +154,7 @@ INA_API(ina_rc_t) ina_list_resize(ina_list_t *list, size_t min_nodes, size_t max
     if (min_nodes < list->count) {
         min_nodes = list->count;
     }
-
-    if (INA_FAILED(ina_mempool_new(
-            sizeof(ina_list_node_t) * min_nodes,
-            NULL,
-
-            INA_MEM_DYNAMIC, &mp))) {
-        return ina_err_get_rc();
-    }
-
-    if (list->mp != NULL) {
-        ina_list_node_t* next;
-        ina_list_node_t* new_mode;
-        ina_list_node_t* new_head = NULL;
-        if (INA_SUCCEED(ina_list_head(list, &next))) {
-            while (next) {
-                new_mode = ina_mempool_dalloc(mp, sizeof(ina_list_node_t));
-                if (new_head == NULL) {
-                    new_head = new_mode;
-                }
-                ina_mem_cpy(new_mode, next, sizeof(ina_list_node_t));
-                next = next->next;
-            }
-        }
-        list->head = new_head;
-        ina_mempool_free(&list->mp);
-    }
-
-    list->mp = mp;
-
-    INA_MEM_FREE_SAFE(list->first_free);
-    list->last_free = 0;
-    if (max_recyclable_nodes) {
-        list->max_recyclable = max_recyclable_nodes;
-        list->first_free = ina_mem_alloc(sizeof(void*)*max_recyclable_nodes);
-        ina_mem_set(list->first_free, 0, sizeof(void*)*max_recyclable_nodes);
-    }
-    return INA_SUCCESS;
+    return ina_slab_reserve(list->slab, min_nodes - list->count);
 }
 
 
@@ -214,13 +175,15 @@ INA_API(ina_rc_t) ina_list_head(ina_list_t *list, ina_list_node_t **node)
 
 INA_API(ina_rc_t) ina_list_usage(ina_list_t *list, size_t *usage)
 {
-    ina_mempool_info_t info;
+    ina_slab_info_t info;
     INA_VERIFY_NOT_NULL(list);
     INA_VERIFY_NOT_NULL(usage);
     *usage = 0;
-    INA_RETURN_IF_FAILED(ina_mempool_info(list->mp, &info));
+    if (list->slab == NULL) {
+        return INA_SUCCESS;
+    }
+    INA_RETURN_IF_FAILED(ina_slab_info(list->slab, &info));
     *usage = info.size;
-    *usage += sizeof(void*)*list->max_recyclable;
     return INA_SUCCESS;
 }
 
@@ -352,12 +315,12 @@ INA_API(ina_rc_t) ina_list_concat(ina_list_t *dest, ina_list_t *src)
 
     src->head = NULL;
     src->count = 0;
-    if (dest->mp != NULL) {
-        ina_mempool_merge(dest->mp, src->mp);
-    } else {
-        dest->mp = src->mp;
+    /* nodes of src belong to dest now, src keeps its empty slab */
+    if (dest->slab != NULL) {
+        return ina_slab_merge(dest->slab, src->slab);
     }
-    src->mp = NULL;
+    dest->slab = src->slab;
+    src->slab = NULL;
     return INA_SUCCESS;
 }
 
@@ -6,39 +6,1429 @@
  * Information and shall use it only in accordance with the terms of the
  * license agreement you entered into with INAOS GmbH.
  */
-#include <sys/stat.h>
+#define INA_MEM_PROFILE_IMPL
 #include <libinac-ce/lib.h>
+#include <sys/stat.h>
 #include "config.h"
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(INA_OS_OSX)
+#include <malloc/malloc.h>
+#endif
+#ifdef INA_OS_LINUX
+#include <sys/syscall.h>
+#endif
+
+struct ina_mempool_s  {
+    ina_handle_t shm_handle;
+    uint32_t cf;
+    size_t size;
+    size_t pos;
+    size_t end;
+    unsigned char *m;
+    void *mem;      /* heap allocation of the chunk, m is aligned in it */
+    ina_str_t label;
+    struct ina_mempool_s *current;
+    struct ina_mempool_s *parent;
+    struct ina_mempool_s *child;
+    ina_list_node_t node;
+    volatile int64_t lock;
+    int64_t epoch;
+    int claimed;
+    struct __ina_free_lists_s *bins;
+    size_t hwm;     /* dirty bytes from the start of the chunk */
+    size_t lwm;     /* dirty bytes from lwm to the end of the chunk */
+    /* chunk directory, maintained by the pool only */
+    struct ina_mempool_s *tail;
+    struct ina_mempool_s *dir;       /* root of the directory treap */
+    struct ina_mempool_s *dir_left;  /* treap links of the chunk */
+    struct ina_mempool_s *dir_right;
+    size_t dir_seq;                  /* largest seq of the subtree */
+    int indexed;                     /* the chunk is in the directory */
+    size_t nchunks;
+    size_t total_size;
+    size_t retired_used;         /* used bytes of chunks except current */
+    size_t seq;                  /* position of the chunk in the chain */
+    size_t barrier;              /* first reusable chunk while marks are set */
+    struct ina_mempool_s *mark;  /* chunk of the innermost mark */
+    size_t mark_pos;             /* position of the innermost mark in it */
+    struct ina_mempool_s *live;  /* last chunk in use since reset */
+    size_t limit;                /* limit of total_size, 0 for none */
+    ina_mempool_limit_fn_t limit_fn;
+    void *limit_arg;
+    struct __ina_guard_s *guards; /* INA_MEM_GUARD allocations */
+    int numa_node;               /* NUMA node of new chunks */
+    int cow;                     /* mapped private while in a snapshot */
+    struct ina_mempool_snapshot_s *snapshot; /* INA_MEM_SNAPSHOT pools */
+};
+
+#define __INA_CHUNK_FREE(pm) ((pm)->end - (pm)->pos)
+#define __INA_CHUNK_USED(pm) ((pm)->pos + ((pm)->size - (pm)->end))
+
+/* Directory order, less free space first, then chunks in chain order */
+#define __INA_DIR_BELOW(a, b) (__INA_CHUNK_FREE(a) < __INA_CHUNK_FREE(b) || \
+    (__INA_CHUNK_FREE(a) == __INA_CHUNK_FREE(b) && (a)->seq < (b)->seq))
+
+/*
+ * Segregated free lists of blocks returned by ina_mempool_dfree(). Small
+ * blocks are binned by exact size, larger blocks by power of two.
+ */
+#define __INA_FREE_SMALL_MAX  (512)
+#define __INA_FREE_SMALL_BINS (__INA_FREE_SMALL_MAX/INA_MEM_ALIGN_SIZE)
+#define __INA_FREE_BINS       (__INA_FREE_SMALL_BINS + sizeof(size_t)*8)
+
+#define __INA_FREE_MAP_WORDS  ((__INA_FREE_BINS+63)/64)
+
+typedef struct __ina_free_block_s {
+    struct __ina_free_block_s *next;
+    struct __ina_free_block_s *prev;
+    size_t size;
+} __ina_free_block_t;
+
+/*
+ * The free blocks are also indexed by their start and end address, a block
+ * is coalesced with its free neighbours and ina_mempool_ralloc() grows into
+ * a free block behind the old one. The open addressing tables are taken from
+ * the pool and dropped together with the free lists.
+ */
+#define __INA_FREE_SLOTS_MIN  (64)
+
+typedef struct __ina_free_lists_s {
+    uint64_t map[__INA_FREE_MAP_WORDS];
+    __ina_free_block_t *bins[__INA_FREE_BINS];
+    __ina_free_block_t **heads;
+    __ina_free_block_t **tails;
+    size_t nslots;
+    size_t count;
+} __ina_free_lists_t;
+
+/*
+ * Header at the beginning of a shared memory pool. The allocation cursor
+ * lives in the mapping so all attached processes allocate disjoint blocks.
+ */
+typedef struct __ina_shm_hdr_s {
+    int64_t refcount;
+    int64_t pos;
+} __ina_shm_hdr_t;
+
+#define __INA_SHM_HDR(pool) ((__ina_shm_hdr_t*)(pool)->m)
+/* The header fills a cache line, the cursor is not shared with user data */
+#define __INA_SHM_HDR_SIZE  (INA_MEM_CACHELINE_SIZE)
+
+/*
+ * Header at the beginning of a file backed pool. Allocations are addressed by
+ * their offset to the mapping, the file may be mapped anywhere on reopen.
+ */
+typedef struct __ina_file_hdr_s {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t hdr_size;
+    uint64_t size;      /* size of the file */
+    uint64_t pos;       /* cursor of ina_mempool_dalloc() */
+    uint64_t end;       /* cursor of ina_mempool_nalloc() */
+    uint64_t root;      /* offset of the root object, 0 for none */
+} __ina_file_hdr_t;
+
+#define __INA_FILE_MAGIC    (0x314C4F4F50414E49ULL) /* "INAPOOL1" */
+#define __INA_FILE_VERSION  (1)
+#define __INA_FILE_HDR(pool) ((__ina_file_hdr_t*)(pool)->m)
+#define __INA_FILE_HDR_SIZE  (INA_MEM_CACHELINE_SIZE)
+
+/* First byte of a chunk available for allocations */
+#define __INA_CHUNK_BASE(pm) ((pm)->cf&INA_MEM_FILE ? __INA_FILE_HDR_SIZE : 0)
+
+/*
+ * Allocation of a INA_MEM_GUARD pool placed in its own mapping, the block
+ * ends at a PROT_NONE page.
+ */
+typedef struct __ina_guard_s {
+    struct __ina_guard_s *next;
+    unsigned char *base;
+    size_t len;
+} __ina_guard_t;
+
+/* Fill byte of freed and reset memory of INA_MEM_GUARD pools */
+#define __INA_MEM_POISON (0xA5)
+#define __INA_GUARD_ALIGN(pool) ((pool)->cf&INA_MEM_CACHEALIGN ? \
+    INA_MEM_CACHELINE_SIZE : INA_MEM_ALIGN_SIZE)
+#define __INA_GUARDED(pool, size) \
+    (INA_UNLIKELY((pool)->cf&INA_MEM_GUARD) && (size) >= INA_MEM_GUARD_SIZE)
+
+/*
+ * Per thread chunk cache of INA_MEM_THREADLOCAL pools, set associative and
+ * keyed by the pool. Ways are not evicted, a thread that finds the set of a
+ * pool full allocates from the shared chunk of the pool under its lock.
+ */
+#define __INA_TCACHE_SETS (16)
+#define __INA_TCACHE_WAYS (4)
+#define __INA_TCACHE_SET(pool) (&__tcache[((((uintptr_t)(pool)) >> 6) & \
+    (__INA_TCACHE_SETS-1))*__INA_TCACHE_WAYS])
+
+/* Owner of a chunk of a INA_MEM_THREADLOCAL pool */
+#define __INA_CLAIM_THREAD (1)
+#define __INA_CLAIM_SHARED (2)
+
+typedef struct __ina_tcache_s {
+    ina_mempool_t *pool;
+    int64_t epoch;
+    ina_mempool_t *chunk;
+} __ina_tcache_t;
+
+/* Aligned block mapped from the operating system, see __ina_mem_map_aligned() */
+typedef struct __ina_mem_map_s {
+    void *ptr;
+    size_t size;
+} __ina_mem_map_t;
+
+static ina_list_t *__pools = NULL;
+static volatile int64_t __epoch = 0;
+static INA_TLS(__ina_tcache_t) __tcache[__INA_TCACHE_SETS*__INA_TCACHE_WAYS];
+/* size of all chunks of all pools and its limit */
+static volatile int64_t __total = 0;
+static volatile int64_t __limit = 0;
+/* callback of the limit, changed and read as a pair under __limit_lock */
+static ina_mempool_limit_fn_t __limit_fn = NULL;
+static void *__limit_arg = NULL;
+static volatile int64_t __limit_lock = 0;
+/* allocator backend, NULL for the compile time default */
+static ina_mem_allocator_t __custom;
+static const ina_mem_allocator_t *__allocator = NULL;
+/* INA_MEM_GUARD environment variable, read by ina_mempool_init() */
+static int __guard_env = 0;
+/* open addressing table of the mapped aligned blocks */
+static __ina_mem_map_t *__maps = NULL;
+static size_t __maps_slots = 0;
+static volatile int64_t __maps_count = 0;
+static volatile int64_t __maps_lock = 0;
+
+static ina_rc_t __ina_shm_open(ina_mempool_t *);
+static ina_rc_t __ina_shm_close(ina_mempool_t *);
+static ina_rc_t __ina_file_open(ina_mempool_t *);
+static void __ina_file_close(ina_mempool_t *);
+static ina_rc_t __ina_file_sync(ina_mempool_t *);
+static ina_rc_t __ina_chunk_map(ina_mempool_t *);
+static void __ina_chunk_unmap(ina_mempool_t *);
+static void __ina_chunk_discard(ina_mempool_t *, size_t, size_t);
+static unsigned char *__ina_guard_map(size_t);
+static void __ina_guard_unmap(unsigned char *, size_t);
+static void __ina_guard_protect(unsigned char *, size_t);
+static void *__ina_mem_map(size_t, size_t);
+static void __ina_mem_unmap(void *, size_t);
+static void *__ina_mem_remap(void *, size_t, size_t, int);
+static ina_rc_t __ina_chunk_bind(ina_mempool_t *, int, int);
+static ina_rc_t __ina_chunk_nodes(ina_mempool_t *, size_t *, size_t);
+static ina_rc_t __ina_snap_map(ina_mempool_t *);
+static ina_rc_t __ina_snap_take(ina_mempool_t *, const unsigned char **);
+static ina_rc_t __ina_snap_restore(ina_mempool_t *);
+static void __ina_snap_unview(const unsigned char *, size_t);
+
+static ina_rc_t __ina_free_pool(void *data)
+{
+    ina_mempool_t *pool = (ina_mempool_t*)data;
+    ina_mempool_free(&pool);
+    return INA_SUCCESS;
+}
+
+/*
+ * Remember the used area of a chunk before pos/end move backwards, so clear
+ * only zeroes what was handed out since the chunk was zero filled.
+ */
+INA_INLINE void __ina_chunk_dirty(ina_mempool_t *pm)
+{
+    if (pm->pos > pm->hwm) {
+        pm->hwm = pm->pos;
+    }
+    if (pm->end < pm->lwm) {
+        pm->lwm = pm->end;
+    }
+}
+
+/* Fill large blocks without evicting the working set from the cache */
+INA_INLINE void __ina_mem_zero(void *ptr, size_t nb)
+{
+    if (nb >= INA_MEM_NT_THRESHOLD) {
+        ina_mem_set_nt(ptr, 0, nb);
+    } else {
+        ina_mem_set(ptr, 0, nb);
+    }
+}
+
+/* Copy a block moved by ina_mempool_ralloc() */
+INA_INLINE void __ina_mem_relocate(void *dest, const void *src, size_t nb)
+{
+    if (nb >= INA_MEM_NT_THRESHOLD) {
+        ina_mem_cpy_nt(dest, src, nb);
+    } else {
+        ina_mem_cpy(dest, src, nb);
+    }
+}
+
+/* Zero fill the range [from, to) of a chunk */
+static void __ina_chunk_zero(ina_mempool_t *pm, size_t from, size_t to)
+{
+    size_t pagesize;
+    size_t pfrom;
+    size_t pto;
+
+    if (from >= to) {
+        return;
+    }
+    if (0 == (pm->cf&(INA_MEM_MMAP|INA_MEM_HUGEPAGE))) {
+        __ina_mem_zero(&pm->m[from], to - from);
+        return;
+    }
+    /* whole pages are dropped, the kernel hands back zero pages */
+    ina_mem_get_pagesize(&pagesize);
+    pfrom = (from + pagesize - 1) & ~(pagesize - 1);
+    pto = to & ~(pagesize - 1);
+    if (pfrom >= pto) {
+        ina_mem_set(&pm->m[from], 0, to - from);
+        return;
+    }
+    ina_mem_set(&pm->m[from], 0, pfrom - from);
+    __ina_chunk_discard(pm, pfrom, pto);
+    ina_mem_set(&pm->m[pto], 0, to - pto);
+}
+
+/* Release the memory of a single chunk */
+static void __ina_chunk_release(ina_mempool_t *pm)
+{
+    /* closing a segment clears the size */
+    size_t size = pm->size;
+
+    if (pm->cf&INA_MEM_SHARED) {
+        __ina_shm_close(pm);
+    } else if (pm->cf&INA_MEM_FILE) {
+        __ina_file_close(pm);
+    } else if (pm->cf&(INA_MEM_MMAP|INA_MEM_HUGEPAGE)) {
+        __ina_chunk_unmap(pm);
+    } else {
+        ina_mem_free(pm->mem);
+    }
+    INA_ATOMIC_ADD(&__total, -(int64_t)size);
+    pm->m = NULL;
+}
+
+INA_INLINE void __ina_limit_lock(void)
+{
+    while (INA_ATOMIC_SWAP(&__limit_lock, 0, 1) != 0) {
+    }
+}
+
+INA_INLINE void __ina_limit_unlock(void)
+{
+    INA_ATOMIC_SWAP(&__limit_lock, 1, 0);
+}
+
+/*
+ * Check the pool and the global limit before size bytes are added, the
+ * callbacks get one chance to make room.
+ */
+static ina_rc_t __ina_mempool_check_limit(ina_mempool_t *pool, size_t size)
+{
+    ina_mempool_limit_fn_t limit_fn;
+    void *limit_arg;
+    size_t limit;
+
+    if (pool != NULL && pool->limit != 0 &&
+        pool->total_size + size > pool->limit) {
+        if (pool->limit_fn == NULL ||
+            INA_FAILED(pool->limit_fn(pool, size, pool->limit_arg)) ||
+            (pool->limit != 0 && pool->total_size + size > pool->limit)) {
+            return INA_ERROR(INA_ERR_POOL_LIMIT);
+        }
+    }
+    limit = (size_t)INA_ATOMIC_LOAD(&__limit);
+    if (limit != 0 && (size_t)INA_ATOMIC_LOAD(&__total) + size > limit) {
+        __ina_limit_lock();
+        limit_fn = __limit_fn;
+        limit_arg = __limit_arg;
+        __ina_limit_unlock();
+        if (limit_fn == NULL || INA_FAILED(limit_fn(pool, size, limit_arg))) {
+            return INA_ERROR(INA_ERR_POOL_LIMIT);
+        }
+        limit = (size_t)INA_ATOMIC_LOAD(&__limit);
+        if (limit != 0 && (size_t)INA_ATOMIC_LOAD(&__total) + size > limit) {
+            return INA_ERROR(INA_ERR_POOL_LIMIT);
+        }
+    }
+    return INA_SUCCESS;
+}
+
+/* Effective size of an allocation */
+INA_INLINE size_t __ina_mempool_size(ina_mempool_t *pool, size_t size)
+{
+    if (pool->cf&INA_MEM_CACHEALIGN) {
+        return INA_MEM_ALIGN_TO(size, INA_MEM_CACHELINE_SIZE);
+    }
+    if (!(pool->cf&INA_MEM_BESTFIT)) {
+        return INA_MEM_ALIGN(size);
+    }
+    return size;
+}
+
+INA_INLINE void __ina_mempool_lock(ina_mempool_t *pool)
+{
+    while (INA_ATOMIC_SWAP(&pool->lock, 0, 1) != 0) {
+    }
+}
+
+INA_INLINE void __ina_mempool_unlock(ina_mempool_t *pool)
+{
+    INA_ATOMIC_SWAP(&pool->lock, 1, 0);
+}
+
+/* Allocate size bytes right below a guard page */
+static void *__ina_guard_alloc(ina_mempool_t *pool, size_t size,
+                               size_t alignment)
+{
+    __ina_guard_t *g;
+    size_t pagesize;
+
+    ina_mem_get_pagesize(&pagesize);
+    size = INA_MEM_ALIGN_TO(size, alignment);
+    g = (__ina_guard_t*)ina_mem_alloc(sizeof(__ina_guard_t));
+    if (g == NULL) {
+        return NULL;
+    }
+    g->len = ((size + pagesize - 1) & ~(pagesize - 1)) + pagesize;
+    g->base = __ina_guard_map(g->len);
+    if (g->base == NULL) {
+        ina_mem_free(g);
+        INA_ERROR(INA_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    __ina_mempool_lock(pool);
+    g->next = pool->guards;
+    pool->guards = g;
+    __ina_mempool_unlock(pool);
+    return g->base + g->len - pagesize - size;
+}
+
+/*
+ * Free memory of a INA_MEM_GUARD pool. Guarded blocks become inaccessible,
+ * other blocks are poisoned. Nothing is reused before reset.
+ */
+static void __ina_guard_free(ina_mempool_t *pool, void *ptr, size_t size)
+{
+    __ina_guard_t *g;
+
+    __ina_mempool_lock(pool);
+    for (g = pool->guards; g != NULL; g = g->next) {
+        if ((unsigned char*)ptr >= g->base && (unsigned char*)ptr < g->base + g->len) {
+            break;
+        }
+    }
+    __ina_mempool_unlock(pool);
+    if (g != NULL) {
+        __ina_guard_protect(g->base, g->len);
+        return;
+    }
+    ina_mem_set(ptr, __INA_MEM_POISON, size);
+}
+
+/* Unmap all guarded blocks of a pool */
+static void __ina_guard_release(ina_mempool_t *pool)
+{
+    __ina_guard_t *g;
+
+    while (pool->guards != NULL) {
+        g = pool->guards;
+        pool->guards = g->next;
+        __ina_guard_unmap(g->base, g->len);
+        ina_mem_free(g);
+    }
+}
+
+INA_INLINE size_t __ina_log2(size_t n)
+{
+#if defined(__GNUC__)
+    return (sizeof(unsigned long long)*8 - 1) - (size_t)__builtin_clzll((unsigned long long)n);
+#else
+    size_t l = 0;
+    while (n >>= 1) {
+        ++l;
+    }
+    return l;
+#endif
+}
+
+INA_INLINE size_t __ina_ctz64(uint64_t n)
+{
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctzll((unsigned long long)n);
+#else
+    size_t l = 0;
+    while (!(n & 1)) {
+        n >>= 1;
+        ++l;
+    }
+    return l;
+#endif
+}
+
+INA_INLINE size_t __ina_free_bin(size_t size)
+{
+    if (size < 2*INA_MEM_ALIGN_SIZE) {
+        return 0;
+    }
+    if (size <= __INA_FREE_SMALL_MAX) {
+        return size/INA_MEM_ALIGN_SIZE - 1;
+    }
+    return __INA_FREE_SMALL_BINS + __ina_log2(size);
+}
+
+INA_INLINE size_t __ina_free_hash(const void *key, size_t mask)
+{
+    return (size_t)(((uint64_t)(uintptr_t)key*0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+/* Address a block is indexed by, its end in the tails table */
+INA_INLINE unsigned char *__ina_free_key(__ina_free_block_t *blk, int tail)
+{
+    return tail ? (unsigned char*)blk + blk->size : (unsigned char*)blk;
+}
+
+static size_t __ina_free_slot(__ina_free_block_t **tab, size_t mask,
+                              const void *key, int tail)
+{
+    size_t i = __ina_free_hash(key, mask);
+
+    while (tab[i] != NULL && __ina_free_key(tab[i], tail) != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Free block starting at key, or ending at key if tail is set */
+static __ina_free_block_t *__ina_free_find(__ina_free_lists_t *fl,
+                                           const void *key, int tail)
+{
+    __ina_free_block_t **tab = tail ? fl->tails : fl->heads;
+
+    if (fl->nslots == 0) {
+        return NULL;
+    }
+    return tab[__ina_free_slot(tab, fl->nslots - 1, key, tail)];
+}
+
+/* Remove a block from a table, later blocks of the probe run move up */
+static void __ina_free_unindex(__ina_free_block_t **tab, size_t mask,
+                               __ina_free_block_t *blk, int tail)
+{
+    size_t i = __ina_free_slot(tab, mask, __ina_free_key(blk, tail), tail);
+    size_t j = i;
+    size_t k;
+
+    if (tab[i] == NULL) {
+        return;
+    }
+    tab[i] = NULL;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (tab[j] == NULL) {
+            return;
+        }
+        k = __ina_free_hash(__ina_free_key(tab[j], tail), mask);
+        if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j)) {
+            tab[i] = tab[j];
+            tab[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+/* Keep the tables at most half full, a block is not indexed if this fails */
+static int __ina_free_reserve(ina_mempool_t *pool, __ina_free_lists_t *fl)
+{
+    __ina_free_block_t **heads;
+    __ina_free_block_t **tails;
+    size_t nslots;
+    size_t i;
+
+    if ((fl->count + 1)*2 <= fl->nslots) {
+        return 1;
+    }
+    nslots = fl->nslots ? fl->nslots*2 : __INA_FREE_SLOTS_MIN;
+    heads = (__ina_free_block_t**)ina_mempool_nalloc(pool,
+            2*nslots*sizeof(__ina_free_block_t*));
+    if (heads == NULL) {
+        /* at least one slot stays empty, lookups stop there */
+        ina_err_reset();
+        return fl->count + 2 <= fl->nslots;
+    }
+    ina_mem_set(heads, 0, 2*nslots*sizeof(__ina_free_block_t*));
+    tails = heads + nslots;
+    /* the old tables stay in the pool until the free lists are dropped */
+    for (i = 0; i < fl->nslots; ++i) {
+        if (fl->heads[i] != NULL) {
+            heads[__ina_free_slot(heads, nslots - 1, fl->heads[i], 0)] = fl->heads[i];
+        }
+        if (fl->tails[i] != NULL) {
+            tails[__ina_free_slot(tails, nslots - 1,
+                                  __ina_free_key(fl->tails[i], 1), 1)] = fl->tails[i];
+        }
+    }
+    fl->heads = heads;
+    fl->tails = tails;
+    fl->nslots = nslots;
+    return 1;
+}
+
+static void __ina_free_insert(ina_mempool_t *pool, __ina_free_lists_t *fl,
+                              void *ptr, size_t size)
+{
+    __ina_free_block_t *blk = (__ina_free_block_t*)ptr;
+    size_t bin = __ina_free_bin(size);
+    size_t mask;
+
+    blk->size = size;
+    blk->prev = NULL;
+    blk->next = fl->bins[bin];
+    if (blk->next != NULL) {
+        blk->next->prev = blk;
+    }
+    fl->bins[bin] = blk;
+    fl->map[bin/64] |= 1ULL << (bin%64);
+
+    if (__ina_free_reserve(pool, fl)) {
+        mask = fl->nslots - 1;
+        fl->heads[__ina_free_slot(fl->heads, mask, blk, 0)] = blk;
+        fl->tails[__ina_free_slot(fl->tails, mask, __ina_free_key(blk, 1), 1)] = blk;
+        fl->count++;
+    }
+}
+
+static void __ina_free_remove(__ina_free_lists_t *fl, __ina_free_block_t *blk)
+{
+    size_t bin = __ina_free_bin(blk->size);
+
+    if (blk->prev != NULL) {
+        blk->prev->next = blk->next;
+    } else {
+        fl->bins[bin] = blk->next;
+        if (blk->next == NULL) {
+            fl->map[bin/64] &= ~(1ULL << (bin%64));
+        }
+    }
+    if (blk->next != NULL) {
+        blk->next->prev = blk->prev;
+    }
+    if (fl->nslots != 0 && fl->heads[__ina_free_slot(fl->heads, fl->nslots - 1, blk, 0)] == blk) {
+        __ina_free_unindex(fl->heads, fl->nslots - 1, blk, 0);
+        __ina_free_unindex(fl->tails, fl->nslots - 1, blk, 1);
+        fl->count--;
+    }
+}
+
+/*
+ * Trim a range to INA_MEM_ALIGN_SIZE, free block headers are aligned. Only
+ * the unaligned ends of INA_MEM_BESTFIT blocks are cut off. Returns 0 if
+ * the range does not hold a header.
+ */
+INA_INLINE int __ina_free_trim(unsigned char **ptr, size_t *size)
+{
+    unsigned char *from = (unsigned char*)INA_MEM_ALIGN((uintptr_t)*ptr);
+    unsigned char *to = (unsigned char*)(((uintptr_t)*ptr + *size) &
+                                         ~(uintptr_t)(INA_MEM_ALIGN_SIZE - 1));
+
+    if (to <= from || (size_t)(to - from) < sizeof(__ina_free_block_t)) {
+        return 0;
+    }
+    *ptr = from;
+    *size = (size_t)(to - from);
+    return 1;
+}
+
+/* Put the aligned part of a range on the free lists */
+static void __ina_free_put(ina_mempool_t *pool, __ina_free_lists_t *fl,
+                           void *ptr, size_t size)
+{
+    unsigned char *m = (unsigned char*)ptr;
+
+    if (__ina_free_trim(&m, &size)) {
+        __ina_free_insert(pool, fl, m, size);
+    }
+}
+
+/* Put a block on the free lists, coalesced with its free neighbours */
+static void __ina_free_push(ina_mempool_t *pool, __ina_free_lists_t *fl,
+                            void *ptr, size_t size)
+{
+    __ina_free_block_t *prev;
+    __ina_free_block_t *next;
+    unsigned char *m = (unsigned char*)ptr;
+
+    if (!__ina_free_trim(&m, &size)) {
+        return;
+    }
+    ptr = m;
+    prev = __ina_free_find(fl, ptr, 1);
+    next = __ina_free_find(fl, (unsigned char*)ptr + size, 0);
+    if (prev != NULL) {
+        __ina_free_remove(fl, prev);
+        ptr = prev;
+        size += prev->size;
+    }
+    if (next != NULL) {
+        __ina_free_remove(fl, next);
+        size += next->size;
+    }
+    __ina_free_insert(pool, fl, ptr, size);
+}
+
+/* Find the first non-empty bin starting at bin */
+INA_INLINE size_t __ina_free_next_bin(__ina_free_lists_t *fl, size_t bin)
+{
+    size_t w = bin/64;
+    uint64_t m = fl->map[w] & (~0ULL << (bin%64));
+
+    while (m == 0) {
+        if (++w == __INA_FREE_MAP_WORDS) {
+            return __INA_FREE_BINS;
+        }
+        m = fl->map[w];
+    }
+    return w*64 + __ina_ctz64(m);
+}
+
+/*
+ * Take a block of at least size bytes from the free lists, the remainder of
+ * a larger block is put back. The size is rounded up to INA_MEM_ALIGN_SIZE,
+ * the remainder starts aligned.
+ */
+static void *__ina_free_take(ina_mempool_t *pool, __ina_free_lists_t *fl,
+                             size_t size)
+{
+    __ina_free_block_t *blk;
+    size_t bin;
+
+    size = size < INA_MEM_ALIGN_SIZE ? INA_MEM_ALIGN_SIZE : INA_MEM_ALIGN(size);
+    bin = __ina_free_bin(size);
+
+    blk = fl->bins[bin];
+    if (blk == NULL || blk->size < size) {
+        /* every block of a higher bin fits */
+        bin = __ina_free_next_bin(fl, bin + 1);
+        if (bin == __INA_FREE_BINS) {
+            return NULL;
+        }
+        blk = fl->bins[bin];
+    }
+    __ina_free_remove(fl, blk);
+    if (blk->size - size >= sizeof(__ina_free_block_t)) {
+        __ina_free_put(pool, fl, (unsigned char*)blk + size, blk->size - size);
+    }
+    return blk;
+}
+
+/*
+ * Grow a block in place into the free block behind it, the remainder stays
+ * free. The added bytes are zero filled like fresh pool memory.
+ */
+static int __ina_free_grow(ina_mempool_t *pool, __ina_free_lists_t *fl,
+                           void *ptr, size_t old_size, size_t new_size)
+{
+    __ina_free_block_t *next = __ina_free_find(fl, (unsigned char*)ptr + old_size, 0);
+    size_t avail;
+
+    if (next == NULL || old_size + next->size < new_size) {
+        return 0;
+    }
+    avail = old_size + next->size;
+    __ina_free_remove(fl, next);
+    if (avail - new_size >= sizeof(__ina_free_block_t)) {
+        __ina_free_put(pool, fl, (unsigned char*)ptr + new_size, avail - new_size);
+    }
+    if (!(pool->cf&INA_MEM_NOZEROFILL)) {
+        ina_mem_set((unsigned char*)ptr + old_size, 0, new_size - old_size);
+    }
+    return 1;
+}
+
+/*
+ * The chunk directory is a treap of the chunks not in use, in
+ * __INA_DIR_BELOW order. Priorities are hashed from the chunk address, every
+ * node keeps the largest seq of its subtree so the best fitting chunk behind
+ * the mark barrier is found in O(log n). The free space of a chunk does not
+ * change while it is indexed.
+ */
+INA_INLINE uintptr_t __ina_dir_prio(const ina_mempool_t *pm)
+{
+    uintptr_t h = (uintptr_t)pm;
+
+    h ^= h >> 15;
+    h *= (uintptr_t)2654435761u;
+    return h ^ (h >> 13);
+}
+
+INA_INLINE void __ina_dir_update(ina_mempool_t *t)
+{
+    t->dir_seq = t->seq;
+    if (t->dir_left != NULL && t->dir_left->dir_seq > t->dir_seq) {
+        t->dir_seq = t->dir_left->dir_seq;
+    }
+    if (t->dir_right != NULL && t->dir_right->dir_seq > t->dir_seq) {
+        t->dir_seq = t->dir_right->dir_seq;
+    }
+}
+
+static ina_mempool_t *__ina_dir_insert(ina_mempool_t *t, ina_mempool_t *pm)
+{
+    ina_mempool_t *c;
+
+    if (t == NULL) {
+        return pm;
+    }
+    if (__INA_DIR_BELOW(pm, t)) {
+        t->dir_left = __ina_dir_insert(t->dir_left, pm);
+        if (__ina_dir_prio(t->dir_left) > __ina_dir_prio(t)) {
+            c = t->dir_left;
+            t->dir_left = c->dir_right;
+            c->dir_right = t;
+            __ina_dir_update(t);
+            t = c;
+        }
+    } else {
+        t->dir_right = __ina_dir_insert(t->dir_right, pm);
+        if (__ina_dir_prio(t->dir_right) > __ina_dir_prio(t)) {
+            c = t->dir_right;
+            t->dir_right = c->dir_left;
+            c->dir_left = t;
+            __ina_dir_update(t);
+            t = c;
+        }
+    }
+    __ina_dir_update(t);
+    return t;
+}
+
+/* Join two treaps, all chunks of a are below the chunks of b */
+static ina_mempool_t *__ina_dir_join(ina_mempool_t *a, ina_mempool_t *b)
+{
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (__ina_dir_prio(a) > __ina_dir_prio(b)) {
+        a->dir_right = __ina_dir_join(a->dir_right, b);
+        __ina_dir_update(a);
+        return a;
+    }
+    b->dir_left = __ina_dir_join(a, b->dir_left);
+    __ina_dir_update(b);
+    return b;
+}
+
+static ina_mempool_t *__ina_dir_erase(ina_mempool_t *t, ina_mempool_t *pm)
+{
+    if (t == pm) {
+        return __ina_dir_join(t->dir_left, t->dir_right);
+    }
+    if (__INA_DIR_BELOW(pm, t)) {
+        t->dir_left = __ina_dir_erase(t->dir_left, pm);
+    } else {
+        t->dir_right = __ina_dir_erase(t->dir_right, pm);
+    }
+    __ina_dir_update(t);
+    return t;
+}
+
+/* First chunk of a subtree not before the barrier */
+static ina_mempool_t *__ina_dir_first(ina_mempool_t *t, size_t barrier)
+{
+    while (t != NULL && t->dir_seq >= barrier) {
+        if (t->dir_left != NULL && t->dir_left->dir_seq >= barrier) {
+            t = t->dir_left;
+        } else if (t->seq >= barrier) {
+            return t;
+        } else {
+            t = t->dir_right;
+        }
+    }
+    return NULL;
+}
+
+/* First chunk with at least size bytes free not before the barrier */
+static ina_mempool_t *__ina_dir_find(ina_mempool_t *t, size_t size,
+                                     size_t barrier)
+{
+    ina_mempool_t *pm;
+
+    while (t != NULL && t->dir_seq >= barrier) {
+        if (__INA_CHUNK_FREE(t) < size) {
+            t = t->dir_right;
+            continue;
+        }
+        /* t fits, so does every chunk of the right subtree */
+        pm = __ina_dir_find(t->dir_left, size, barrier);
+        if (pm != NULL) {
+            return pm;
+        }
+        if (t->seq >= barrier) {
+            return t;
+        }
+        return __ina_dir_first(t->dir_right, barrier);
+    }
+    return NULL;
+}
+
+static void __ina_dir_push(ina_mempool_t *pool, ina_mempool_t *pm)
+{
+    pm->dir_left = NULL;
+    pm->dir_right = NULL;
+    pm->dir_seq = pm->seq;
+    pm->indexed = 1;
+    pool->dir = __ina_dir_insert(pool->dir, pm);
+}
+
+static void __ina_dir_remove(ina_mempool_t *pool, ina_mempool_t *pm)
+{
+    if (pm->indexed) {
+        pool->dir = __ina_dir_erase(pool->dir, pm);
+        pm->indexed = 0;
+    }
+}
+
+/*
+ * Take the chunk with least free space that still has size bytes left (best
+ * fit). While marks are active only chunks created after the last mark are
+ * reused.
+ */
+static ina_mempool_t *__ina_dir_pop(ina_mempool_t *pool, size_t size)
+{
+    ina_mempool_t *pm = __ina_dir_find(pool->dir, size, pool->barrier);
+
+    if (pm != NULL) {
+        __ina_dir_remove(pool, pm);
+    }
+    return pm;
+}
+
+/* Index the chunks [from, to) of the chain as well, to NULL for all */
+static void __ina_dir_rebuild(ina_mempool_t *pool, ina_mempool_t *from,
+                              ina_mempool_t *to)
+{
+    ina_mempool_t *pm;
+
+    for (pm = from; pm != to; pm = pm->child) {
+        __ina_dir_push(pool, pm);
+    }
+}
+
+/* Create a new chunk for at least size bytes and append it to the pool */
+static ina_mempool_t *__ina_mempool_add_chunk(ina_mempool_t *pool, size_t size)
+{
+    ina_mempool_t *pm;
+    size_t nsize;
+
+    if (pool->cf&INA_MEM_AUTOSIZE || size > pool->size) {
+        nsize = size;
+    } else {
+        nsize = pool->size;
+    }
+    if (INA_FAILED(__ina_mempool_check_limit(pool, nsize))) {
+        return NULL;
+    }
+    /* FIXME: shm can not handled in chunks ! */
+    if (pool->numa_node == INA_MEM_NODE_ANY) {
+        if (INA_FAILED(ina_mempool_new(nsize, NULL, pool->cf | INA_MEM_CHILD, &pm))) {
+            return NULL;
+        }
+    } else {
+        /* mapped chunks are page aligned and not touched before the bind */
+        if (INA_FAILED(ina_mempool_new(nsize, NULL, pool->cf | INA_MEM_CHILD | INA_MEM_MMAP, &pm))) {
+            return NULL;
+        }
+        if (INA_FAILED(__ina_chunk_bind(pm, pool->numa_node, 0))) {
+            /* placement is a hint, the chunk is usable anyway */
+            ina_err_reset();
+        }
+    }
+    pm->parent = pool->tail;
+    pm->seq = pool->nchunks;
+    pool->tail->child = pm;
+    pool->tail = pm;
+    pool->live = pm;
+    ++pool->nchunks;
+    pool->total_size += pm->size;
+    return pm;
+}
+
+/*
+ * Switch the current chunk to one with at least size bytes available. The
+ * chunk with least free space that fits is reused before the pool grows.
+ */
+static ina_mempool_t *__ina_mempool_next_chunk(ina_mempool_t *pool, size_t size)
+{
+    ina_mempool_t *pm;
+
+    if (!(pool->cf&INA_MEM_DYNAMIC)) {
+        INA_ERROR(INA_ERR_POOL_FULL);
+        return NULL;
+    }
+    pm = __ina_dir_pop(pool, size);
+    if (pm == NULL) {
+        pm = __ina_mempool_add_chunk(pool, size);
+        if (pm == NULL) {
+            return NULL;
+        }
+    } else {
+        pool->retired_used -= __INA_CHUNK_USED(pm);
+        if (pm->seq > pool->live->seq) {
+            pool->live = pm;
+        }
+    }
+    pool->retired_used += __INA_CHUNK_USED(pool->current);
+    __ina_dir_push(pool, pool->current);
+    pool->current = pm;
+    return pm;
+}
+
+/*
+ * Whether ptr was allocated after the innermost mark. Memory of the mark's
+ * chunk behind its position and chunks taken into use since the mark are
+ * searched, blocks before the mark must not be recycled until it is released.
+ */
+static int __ina_mempool_after_mark(ina_mempool_t *pool, const void *ptr)
+{
+    const unsigned char *p = (const unsigned char*)ptr;
+    ina_mempool_t *pm;
+
+    if (pool->mark == NULL) {
+        return 1;
+    }
+    pm = pool->mark;
+    if (p >= &pm->m[pool->mark_pos] && p < &pm->m[pm->size]) {
+        return 1;
+    }
+    for (pm = pool->live; pm->seq >= pool->barrier; pm = pm->parent) {
+        if (p >= pm->m && p < &pm->m[pm->size]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Lock-free bump allocation from the cursor of a shared memory pool. Once a
+ * request did not fit, the segment stays full until reset.
+ */
+INA_INLINE void *__ina_shm_alloc(ina_mempool_t *pool, size_t size)
+{
+    int64_t pos;
+
+    pos = INA_ATOMIC_ADD(&__INA_SHM_HDR(pool)->pos, (int64_t)size);
+    if (INA_UNLIKELY(pool->pos + (size_t)pos + size > pool->end ||
+                     pool->pos + (size_t)pos + size < pool->pos)) {
+        INA_ERROR(INA_ERR_POOL_FULL);
+        return NULL;
+    }
+    return &pool->m[pool->pos + (size_t)pos];
+}
+
+/*
+ * Aligned variant of __ina_shm_alloc(). The cursor is advanced by the padding
+ * and the size only, so it stays aligned to INA_MEM_ALIGN_SIZE and no bytes
+ * are left behind the block.
+ */
+static void *__ina_shm_alloc_aligned(ina_mempool_t *pool, size_t size,
+                                     size_t alignment)
+{
+    __ina_shm_hdr_t *hdr = __INA_SHM_HDR(pool);
+    int64_t pos;
+    int64_t seen;
+    size_t pad;
+
+    pos = INA_ATOMIC_LOAD(&hdr->pos);
+    for (;;) {
+        pad = (alignment - ((uintptr_t)&pool->m[pool->pos + (size_t)pos] &
+                            (alignment - 1))) & (alignment - 1);
+        if (INA_UNLIKELY(pool->pos + (size_t)pos + pad + size > pool->end ||
+                         pool->pos + (size_t)pos + pad + size < pool->pos)) {
+            INA_ERROR(INA_ERR_POOL_FULL);
+            return NULL;
+        }
+        seen = INA_ATOMIC_SWAP(&hdr->pos, pos, pos + (int64_t)(pad + size));
+        if (seen == pos) {
+            return &pool->m[pool->pos + (size_t)pos + pad];
+        }
+        pos = seen;
+    }
+}
+
+/*
+ * Take an unclaimed chunk with at least size bytes available, the pool lock
+ * is held. Unclaimed chunks (returned by reset) are reused before the pool
+ * grows.
+ */
+static ina_mempool_t *__ina_mempool_tl_take(ina_mempool_t *pool, size_t size)
+{
+    ina_mempool_t *pm;
+
+    /* the pool itself is not indexed by the directory */
+    if (!pool->claimed && __INA_CHUNK_FREE(pool) >= size) {
+        pm = pool;
+    } else {
+        pm = __ina_dir_pop(pool, size);
+    }
+    if (pm == NULL) {
+        if (!(pool->cf&INA_MEM_DYNAMIC)) {
+            INA_ERROR(INA_ERR_POOL_FULL);
+            return NULL;
+        }
+        pm = __ina_mempool_add_chunk(pool, size);
+    }
+    return pm;
+}
+
+/* Return a claimed chunk and its free space to the pool, the lock is held */
+static void __ina_mempool_tl_return(ina_mempool_t *pool, ina_mempool_t *pm)
+{
+    pm->claimed = 0;
+    if (pm != pool) {
+        __ina_dir_push(pool, pm);
+    }
+}
+
+/*
+ * Hand out a chunk with at least size bytes available to the calling thread,
+ * tc is the way of the pool or NULL. The chunk the thread dropped goes back
+ * to the pool. Without a free way the shared chunk is returned and shared is
+ * set, the caller allocates from it and releases the pool lock.
+ */
+static ina_mempool_t *__ina_mempool_tl_claim(ina_mempool_t *pool, size_t size,
+                                             __ina_tcache_t *tc, int *shared)
+{
+    ina_mempool_t *pm;
+    int i;
+
+    __ina_mempool_lock(pool);
+    if (tc == NULL) {
+        tc = __INA_TCACHE_SET(pool);
+        for (i = 0; i < __INA_TCACHE_WAYS && tc->pool != NULL; ++i, ++tc) {
+        }
+        if (i == __INA_TCACHE_WAYS) {
+            pm = pool->current;
+            if (pm->claimed == __INA_CLAIM_SHARED && __INA_CHUNK_FREE(pm) >= size) {
+                *shared = 1;
+                return pm;
+            }
+            if (pm->claimed == __INA_CLAIM_SHARED) {
+                __ina_mempool_tl_return(pool, pm);
+            }
+            pm = __ina_mempool_tl_take(pool, size);
+            if (pm == NULL) {
+                __ina_mempool_unlock(pool);
+                return NULL;
+            }
+            pm->claimed = __INA_CLAIM_SHARED;
+            pool->current = pm;
+            *shared = 1;
+            return pm;
+        }
+    } else if (tc->epoch == pool->epoch) {
+        __ina_mempool_tl_return(pool, tc->chunk);
+        tc->pool = NULL;
+    }
+    pm = __ina_mempool_tl_take(pool, size);
+    if (pm == NULL) {
+        __ina_mempool_unlock(pool);
+        return NULL;
+    }
+    pm->claimed = __INA_CLAIM_THREAD;
+    __ina_mempool_unlock(pool);
+
+    tc->pool = pool;
+    tc->epoch = pool->epoch;
+    tc->chunk = pm;
+    return pm;
+}
+
+/*
+ * Return the chunk owned by the calling thread, claim a new one if the thread
+ * has none or size does not fit anymore. If shared is set on return the pool
+ * lock is held, see __ina_mempool_tl_claim().
+ */
+INA_INLINE ina_mempool_t *__ina_mempool_tl_chunk(ina_mempool_t *pool, size_t size,
+                                                 int *shared)
+{
+    __ina_tcache_t *tc = __INA_TCACHE_SET(pool);
+    int i;
+
+    *shared = 0;
+    for (i = 0; i < __INA_TCACHE_WAYS; ++i, ++tc) {
+        if (tc->pool != pool) {
+            continue;
+        }
+        if (INA_LIKELY(tc->epoch == pool->epoch &&
+                       tc->chunk->pos + size <= tc->chunk->end &&
+                       tc->chunk->pos + size >= tc->chunk->pos)) {
+            return tc->chunk;
+        }
+        return __ina_mempool_tl_claim(pool, size, tc, shared);
+    }
+    return __ina_mempool_tl_claim(pool, size, NULL, shared);
+}
+
+/* Drop the ways of a pool from the cache of the calling thread */
+static void __ina_mempool_tl_forget(ina_mempool_t *pool)
+{
+    __ina_tcache_t *tc = __INA_TCACHE_SET(pool);
+    int i;
+
+    for (i = 0; i < __INA_TCACHE_WAYS; ++i, ++tc) {
+        if (tc->pool == pool) {
+            tc->pool = NULL;
+        }
+    }
+}
+
+INA_API(ina_rc_t) ina_mem_set_allocator(const ina_mem_allocator_t *allocator)
+{
+if (allocator == NULL) {
+__allocator = NULL;
+return INA_SUCCESS;
+}
+INA_VERIFY_NOT_NULL(allocator->alloc);
+INA_VERIFY_NOT_NULL(allocator->realloc);
+INA_VERIFY_NOT_NULL(allocator->free);
+INA_VERIFY_NOT_NULL(allocator->alloc_aligned);
+__custom = *allocator;
+__allocator = &__custom;
+return INA_SUCCESS;
+}
+
+INA_API(void *) ina_mem_alloc(size_t size)
+{
+void *ptr;
+
+/*
+ * Same behavior as in c-runtime
+ */
+if (INA_UNLIKELY(size == 0)) {
+ina_err_reset();
+return NULL;
+}
+if (INA_LIKELY(__allocator == NULL)) {
+ptr = INA_MEM_MALLOC(size);
+} else {
+ptr = __allocator->alloc(__allocator->ctx, size);
+}
+if (INA_UNLIKELY(ptr == NULL)) {
+INA_ERROR(INA_ERR_OUT_OF_MEMORY);
+}
+return ptr;
+}
+
+INA_API(void *) ina_mem_calloc(size_t size)
+{
+void *ptr;
+
+if (INA_UNLIKELY(size == 0)) {
+ina_err_reset();
+return NULL;
+}
+if (INA_LIKELY(__allocator == NULL)) {
+ptr = INA_MEM_CALLOC(1, size);
+} else if ((ptr = __allocator->alloc(__allocator->ctx, size)) != NULL) {
+ina_mem_set(ptr, 0, size);
+}
+if (INA_UNLIKELY(ptr == NULL)) {
+INA_ERROR(INA_ERR_OUT_OF_MEMORY);
+}
+return ptr;
+}
+
+/*
+ * Aligned blocks of at least INA_MEM_MMAP_THRESHOLD bytes are mapped page
+ * granular from the operating system. The mappings are registered by address,
+ * so ina_mem_free_aligned() tells them from heap blocks and knows their size.
+ * Mapped blocks are at least 4 KB aligned, other addresses are not looked up.
+ */
+#define __INA_MEM_MAP_MAYBE(ptr) \
+    (((uintptr_t)(ptr) & 4095) == 0 && INA_ATOMIC_LOAD(&__maps_count) > 0)
+
+INA_INLINE void __ina_mem_maps_lock(void)
+{
+    while (INA_ATOMIC_SWAP(&__maps_lock, 0, 1) != 0) {
+    }
+}
+
+INA_INLINE void __ina_mem_maps_unlock(void)
+{
+    INA_ATOMIC_SWAP(&__maps_lock, 1, 0);
+}
+
+INA_INLINE size_t __ina_mem_maps_slot(const void *ptr, size_t slots)
+{
+    return (size_t)(((uintptr_t)ptr >> 12) * (uintptr_t)2654435761u) &
+           (slots - 1);
+}
+
+static void __ina_mem_maps_put(__ina_mem_map_t *maps, size_t slots,
+                               void *ptr, size_t size)
+{
+    size_t i = __ina_mem_maps_slot(ptr, slots);
+
+    while (maps[i].ptr != NULL) {
+        i = (i + 1) & (slots - 1);
+    }
+    maps[i].ptr = ptr;
+    maps[i].size = size;
+}
+
+/* Find a mapped block, the lock is held */
+static __ina_mem_map_t *__ina_mem_maps_find(const void *ptr)
+{
+    size_t i;
+
+    if (__maps_slots == 0) {
+        return NULL;
+    }
+    i = __ina_mem_maps_slot(ptr, __maps_slots);
+    while (__maps[i].ptr != NULL) {
+        if (__maps[i].ptr == ptr) {
+            return &__maps[i];
+        }
+        i = (i + 1) & (__maps_slots - 1);
+    }
+    return NULL;
+}
 
-struct ina_mempool_s  {
-    ina_handle_t shm_handle;
-    uint32_t cf;
-    size_t size;
-    size_t pos;
-    size_t end;
-    unsigned char *m;
-    ina_str_t label;
-    struct ina_mempool_s *current;
-    struct ina_mempool_s *parent;
-    struct ina_mempool_s *child;
-    ina_list_node_t node;
-};
+/* Register a mapped block, the lock is held. The table is kept half empty. */
+static int __ina_mem_maps_add(void *ptr, size_t size)
+{
+    __ina_mem_map_t *maps;
+    size_t slots;
+    size_t i;
+
+    if ((size_t)(__maps_count + 1) * 2 > __maps_slots) {
+        slots = __maps_slots == 0 ? 64 : __maps_slots * 2;
+        maps = (__ina_mem_map_t*)ina_mem_calloc(slots*sizeof(__ina_mem_map_t));
+        if (maps == NULL) {
+            return 0;
+        }
+        for (i = 0; i < __maps_slots; ++i) {
+            if (__maps[i].ptr != NULL) {
+                __ina_mem_maps_put(maps, slots, __maps[i].ptr, __maps[i].size);
+            }
+        }
+        ina_mem_free(__maps);
+        __maps = maps;
+        __maps_slots = slots;
+    }
+    __ina_mem_maps_put(__maps, __maps_slots, ptr, size);
+    __maps_count++;
+    return 1;
+}
 
+/* Unregister a mapped block, later entries of the probe run move up */
+static void __ina_mem_maps_del(__ina_mem_map_t *e)
+{
+    size_t i = (size_t)(e - __maps);
+    size_t j = i;
+    size_t k;
+
+    for (;;) {
+        j = (j + 1) & (__maps_slots - 1);
+        if (__maps[j].ptr == NULL) {
+            break;
+        }
+        k = __ina_mem_maps_slot(__maps[j].ptr, __maps_slots);
+        /* the entry stays if its home slot is cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        __maps[i] = __maps[j];
+        i = j;
+    }
+    __maps[i].ptr = NULL;
+    __maps_count--;
+}
 
-static ina_list_t *__pools = NULL;
+/* Size of a mapped block or 0 for a heap block, take unregisters the block */
+static size_t __ina_mem_map_lookup(void *ptr, int take)
+{
+    __ina_mem_map_t *e;
+    size_t size = 0;
 
-static ina_rc_t __ina_shm_open(ina_mempool_t *);
-static ina_rc_t __ina_shm_close(ina_mempool_t *);
+    if (ptr == NULL || !__INA_MEM_MAP_MAYBE(ptr)) {
+        return 0;
+    }
+    __ina_mem_maps_lock();
+    e = __ina_mem_maps_find(ptr);
+    if (e != NULL) {
+        size = e->size;
+        if (take) {
+            __ina_mem_maps_del(e);
+        }
+    }
+    __ina_mem_maps_unlock();
+    return size;
+}
 
-static ina_rc_t __ina_free_pool(void *data)
+/* Map and register an aligned block, NULL if it has to come from the heap */
+static void *__ina_mem_map_aligned(size_t alignment, size_t size)
 {
-    ina_mempool_t *pool = (ina_mempool_t*)data;
-    ina_mempool_free(&pool);
-    return INA_SUCCESS;
+    size_t pagesize;
+    void *ptr;
+    int ok;
+
+    ina_mem_get_pagesize(&pagesize);
+    size = (size + pagesize - 1) & ~(pagesize - 1);
+    ptr = __ina_mem_map(INA_MAX(alignment, pagesize), size);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    __ina_mem_maps_lock();
+    ok = __ina_mem_maps_add(ptr, size);
+    __ina_mem_maps_unlock();
+    if (!ok) {
+        __ina_mem_unmap(ptr, size);
+        return NULL;
+    }
+    return ptr;
+}
+
+/*
+ * Resize a mapped block, in place if the pages behind it are free. Mappings
+ * are only moved if the page alignment is sufficient. NULL if the block has
+ * to be copied, the block is unchanged then.
+ */
+static void *__ina_mem_map_resize(void *ptr, size_t old_size, size_t alignment,
+                                  size_t size)
+{
+    size_t pagesize;
+    void *p;
+
+    ina_mem_get_pagesize(&pagesize);
+    size = (size + pagesize - 1) & ~(pagesize - 1);
+    if (size == old_size) {
+        return ptr;
+    }
+    p = __ina_mem_remap(ptr, old_size, size, alignment <= pagesize);
+    if (p == NULL) {
+        return NULL;
+    }
+    __ina_mem_maps_lock();
+    if (p == ptr) {
+        __ina_mem_maps_find(ptr)->size = size;
+    } else {
+        /* one entry out, one in, the table does not grow */
+        __ina_mem_maps_del(__ina_mem_maps_find(ptr));
+        __ina_mem_maps_add(p, size);
+    }
+    __ina_mem_maps_unlock();
+    return p;
 }
 
 INA_API(void *) ina_mem_alloc_aligned(size_t alignment, size_t size)
 {
+void *ptr;
+
 /*
  * Same behavior as in c-runtime
  */
@@ -47,51 +1437,152 @@ ina_err_reset();
 return NULL;
 }
 
-if (INA_UNLIKELY(alignment == 0)) {
+if (INA_UNLIKELY(alignment == 0 || (alignment & (alignment - 1)) != 0)) {
 INA_ERROR(INA_ERR_INVALID_ARGUMENT);
 return NULL;
 }
-
-/* Allocate necessary memory area
- * client request - size parameter -
- * plus area to store the address
- * of the memory returned by standard
- * malloc().
- */
-void *p = INA_MEM_MALLOC(size + alignment - 1 + sizeof(void*));
-
-if (INA_UNLIKELY(p != NULL)) {
-void *ptr;
-/* Address of the aligned memory according to the align parameter*/
-ptr = (void*) (((size_t)p + sizeof(void*) + alignment -1) & ~(alignment-1));
-/* store the address of the malloc() above
- * at the beginning of our total memory area.
- * You can also use *((void **)ptr-1) = p
- * instead of the one below.
- */
-*((void**)((size_t)ptr - sizeof(void*))) = p;
-/* Return the address of aligned memory */
+/* posix_memalign requires a multiple of sizeof(void*) */
+if (alignment < sizeof(void*)) {
+alignment = sizeof(void*);
+}
+if (__allocator == NULL && size >= INA_MEM_MMAP_THRESHOLD &&
+    (ptr = __ina_mem_map_aligned(alignment, size)) != NULL) {
 return ptr;
 }
+if (INA_UNLIKELY(__allocator != NULL)) {
+ptr = __allocator->alloc_aligned(__allocator->ctx, alignment, size);
+} else if (INA_MEM_MEMALIGN(&ptr, alignment, size) != 0) {
+ptr = NULL;
+}
+if (INA_UNLIKELY(ptr == NULL)) {
 INA_ERROR(INA_ERR_OUT_OF_MEMORY);
-return NULL;
+}
+return ptr;
 }
 
 INA_API(void*) ina_mem_realloc(void *ptr, size_t nb)
 {
     void *p;
-    INA_ASSERT_NOT_NULL(ptr);
-    p = *((void**)((size_t)ptr - sizeof(void*)));
 
     if (nb == 0) {
         ina_mem_free(ptr);
         return NULL;
     }
+    if (INA_LIKELY(__allocator == NULL)) {
+        p = INA_MEM_REALLOC(ptr, nb);
+    } else {
+        p = __allocator->realloc(__allocator->ctx, ptr, nb);
+    }
+    if (INA_UNLIKELY(p == NULL)) {
+        INA_ERROR(INA_ERR_OUT_OF_MEMORY);
+    }
+    return p;
+}
+
+INA_API(void*) ina_mem_realloc_aligned(void *ptr, size_t alignment, size_t nb)
+{
+    size_t old_size;
+    void *p;
+    void *q;
+
+    if (ptr == NULL) {
+        return ina_mem_alloc_aligned(alignment, nb);
+    }
+    if (nb == 0) {
+        ina_mem_free_aligned(ptr);
+        return NULL;
+    }
+    if (INA_UNLIKELY(alignment == 0 || (alignment & (alignment - 1)) != 0)) {
+        INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+        return NULL;
+    }
+#ifdef INA_OS_WIN32
+    if (__allocator == NULL) {
+        p = _aligned_realloc(ptr, nb, alignment);
+        if (INA_UNLIKELY(p == NULL)) {
+            INA_ERROR(INA_ERR_OUT_OF_MEMORY);
+        }
+        return p;
+    }
+#endif
+    if (__allocator == NULL && (old_size = __ina_mem_map_lookup(ptr, 0)) != 0) {
+        /* mapped block, remap it while it stays large */
+        if (nb >= INA_MEM_MMAP_THRESHOLD &&
+            (p = __ina_mem_map_resize(ptr, old_size, alignment, nb)) != NULL) {
+            return p;
+        }
+    } else {
+        old_size = ina_mem_usable_size(ptr);
+    }
+    /* the new block is allocated first, the old block stays valid on failure */
+    q = ina_mem_alloc_aligned(alignment, nb);
+    if (INA_UNLIKELY(q == NULL)) {
+        return NULL;
+    }
+    if (old_size != 0) {
+        ina_mem_cpy(q, ptr, INA_MIN(old_size, nb));
+        ina_mem_free_aligned(ptr);
+        return q;
+    }
+    /* size unknown, realloc grows in place or moves and copies for us */
+    p = ina_mem_realloc(ptr, nb);
+    if (INA_UNLIKELY(p == NULL)) {
+        ina_mem_free_aligned(q);
+        return NULL;
+    }
+    if (INA_MEM_IS_ALIGNED(p, alignment)) {
+        ina_mem_free_aligned(q);
+        return p;
+    }
+    ina_mem_cpy(q, p, nb);
+    ina_mem_free_aligned(p);
+    return q;
+}
+
+INA_API(void) ina_mem_free(void *ptr)
+{
+    if (INA_LIKELY(__allocator == NULL)) {
+        INA_MEM_FREE(ptr);
+    } else if (ptr != NULL) {
+        __allocator->free(__allocator->ctx, ptr);
+    }
+}
 
-    p = INA_MEM_REALLOC(p, nb+ sizeof(void*) - 1 + sizeof(void*));
-    ptr = (void*) (((size_t)p + sizeof(void*) + sizeof(void*) -1) & ~(sizeof(void*)-1));
-    *((void**)((size_t)ptr - sizeof(void*))) = p;
-    return ptr;
+INA_API(void) ina_mem_free_aligned(void *ptr)
+{
+    size_t size;
+
+    if (INA_LIKELY(__allocator == NULL)) {
+        if ((size = __ina_mem_map_lookup(ptr, 1)) != 0) {
+            __ina_mem_unmap(ptr, size);
+            return;
+        }
+        INA_MEM_ALIGNED_FREE(ptr);
+    } else if (ptr != NULL) {
+        __allocator->free(__allocator->ctx, ptr);
+    }
+}
+
+INA_API(size_t) ina_mem_usable_size(void *ptr)
+{
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (__allocator != NULL) {
+        if (__allocator->usable_size == NULL) {
+            return 0;
+        }
+        return __allocator->usable_size(__allocator->ctx, ptr);
+    }
+#if defined(INA_OS_WIN32)
+    return _msize(ptr);
+#elif defined(__GLIBC__)
+    return malloc_usable_size(ptr);
+#elif defined(INA_OS_OSX)
+    return malloc_size(ptr);
+#else
+    return 0;
+#endif
 }
 
 INA_API(ina_rc_t) ina_mem_get_pagesize(size_t *size)
@@ -110,8 +1601,13 @@ return INA_SUCCESS;
 
 INA_API(ina_rc_t) ina_mempool_init(void)
 {
+    const char *e;
+
     INA_INIT_GUARD();
     INA_RETURN_IF_FAILED(ina_list_new(INA_LIST_CF_NOMALLOC, &__pools));
+    /* pools get INA_MEM_GUARD if the variable is set and not 0 */
+    e = getenv("INA_MEM_GUARD");
+    __guard_env = e != NULL && *e != '\0' && strcmp(e, "0") != 0;
     return INA_SUCCESS;
 }
 
@@ -126,11 +1622,32 @@ INA_API(ina_rc_t) ina_mempool_new(size_t size, const char *label, uint32_t cf, i
 {
 INA_VERIFY_NOT_NULL(pool);
 INA_VERIFY(size > 0);
+INA_VERIFY(!((cf&INA_MEM_THREADLOCAL) && (cf&INA_MEM_SHARED)));
+INA_VERIFY(!((cf&INA_MEM_FILE) &&
+             (cf&(INA_MEM_DYNAMIC|INA_MEM_SHARED|INA_MEM_THREADLOCAL))));
+INA_VERIFY(!(cf&INA_MEM_FILE) || label != NULL);
+INA_VERIFY(!((cf&INA_MEM_SNAPSHOT) &&
+             (cf&(INA_MEM_SHARED|INA_MEM_FILE|INA_MEM_THREADLOCAL))));
 
 if (size < INA_MEM_MIN_POOL_SIZE) {
 size = INA_MEM_MIN_POOL_SIZE;
 }
+if (cf&(INA_MEM_SHARED|INA_MEM_FILE|INA_MEM_SNAPSHOT)) {
+cf &= ~INA_MEM_GUARD;
+} else if (!(cf&INA_MEM_CHILD) && __guard_env) {
+cf |= INA_MEM_GUARD;
+}
+if (cf&INA_MEM_SNAPSHOT) {
+cf |= INA_MEM_MMAP;
+}
+if (cf&INA_MEM_CACHEALIGN) {
+size = INA_MEM_ALIGN_TO(size, INA_MEM_CACHELINE_SIZE);
+} else {
 size = INA_MEM_ALIGN(size);
+}
+if (!(cf&INA_MEM_CHILD)) {
+INA_RETURN_IF_FAILED(__ina_mempool_check_limit(NULL, size));
+}
 
 *pool = (ina_mempool_t*)ina_mem_alloc(sizeof(ina_mempool_t));
 INA_RETURN_IF_NULL(*pool);
@@ -138,7 +1655,10 @@ INA_MEM_SET_ZERO(*pool, ina_mempool_t);
 (*pool)->cf = cf;
 (*pool)->size = size;
 (*pool)->end = (*pool)->size;
+(*pool)->lwm = (*pool)->size;
 (*pool)->current = *pool;
+(*pool)->numa_node = INA_MEM_NODE_ANY;
+(*pool)->epoch = INA_ATOMIC_INC(&__epoch) + 1;
 if (label != NULL) {
 (*pool)->label = ina_str_new_fromcstr(label);
 };
@@ -151,25 +1671,54 @@ ina_mem_free(*pool);
 *pool = NULL;
 return ina_err_get_rc();
 }
+} else if (cf&INA_MEM_FILE) {
+if (INA_FAILED((__ina_file_open(*pool)))) {
+ina_str_free((*pool)->label);
+ina_mem_free(*pool);
+*pool = NULL;
+return ina_err_get_rc();
+}
+} else if (cf&(INA_MEM_MMAP|INA_MEM_HUGEPAGE)) {
+/* anonymous mappings are zero filled by the kernel */
+(*pool)->shm_handle = 0;
+if (INA_FAILED(__ina_chunk_map(*pool))) {
+if ((*pool)->label != NULL) {
+ina_str_free((*pool)->label);
+}
+ina_mem_free(*pool);
+*pool = NULL;
+return ina_err_get_rc();
+}
 } else {
 (*pool)->shm_handle = 0;
-(*pool)->m = (unsigned char*)ina_mem_alloc(size);
-if (0 == (cf&INA_MEM_NOZEROFILL)) {
-ina_mem_set((*pool)->m, 0, (*pool)->size);
+/* calloc hands out zero pages for large chunks, align by hand */
+if (cf&INA_MEM_NOZEROFILL) {
+(*pool)->mem = ina_mem_alloc(size + INA_MEM_CACHELINE_SIZE - 1);
+/* not zero filled, clear fills the whole chunk */
+(*pool)->hwm = size;
+(*pool)->lwm = 0;
+} else {
+(*pool)->mem = ina_mem_calloc(size + INA_MEM_CACHELINE_SIZE - 1);
 }
+(*pool)->m = (unsigned char*)INA_MEM_ALIGN_TO((uintptr_t)(*pool)->mem, INA_MEM_CACHELINE_SIZE);
 }
 
 if ((*pool)->m == NULL) {
-ina_mem_free(*pool);
 if ((*pool)->label != NULL) {
 ina_str_free((*pool)->label);
 }
+ina_mem_free(*pool);
 *pool = NULL;
 return INA_ERROR(INA_ERR_OUT_OF_MEMORY);
 }
+INA_ATOMIC_ADD(&__total, (int64_t)(*pool)->size);
 if ((*pool)->cf&INA_MEM_CHILD) {
 return INA_SUCCESS;
 }
+(*pool)->tail = *pool;
+(*pool)->live = *pool;
+(*pool)->nchunks = 1;
+(*pool)->total_size = (*pool)->size;
 ina_list_insert_tail(__pools, &(*pool)->node);
 return INA_SUCCESS;
 }
@@ -187,7 +1736,17 @@ if ((*pool)->parent != NULL) {
 }
 INA_MUST_SUCCEED(ina_list_remove(__pools, &(*pool)->node));
 
+if ((*pool)->cf&INA_MEM_THREADLOCAL) {
+/* ways of other threads are reclaimed when the address is reused */
+__ina_mempool_tl_forget(*pool);
+}
+if ((*pool)->snapshot != NULL) {
+/* the views stay valid until the snapshot is freed */
+(*pool)->snapshot->pool = NULL;
+}
 (*pool)->current = *pool;
+(*pool)->dir = NULL;
+__ina_guard_release(*pool);
 
 pn = *pool;
 while (pn != NULL) {
@@ -195,115 +1754,463 @@ pm = pn;
 if (pn != pn->child) {
 pn = pn->child;
 }
-if (pm->cf&INA_MEM_SHARED) {
-__ina_shm_close(pm);
-} else {
-ina_mem_free(pm->m);
+__ina_chunk_release(pm);
+ina_mem_free(pm);
+}
+}
+
+INA_API(ina_rc_t) ina_mempool_merge(ina_mempool_t *dest, ina_mempool_t *src)
+{
+ina_mempool_t *pm;
+
+INA_VERIFY_NOT_NULL(dest);
+
+if (src == NULL) {
+return INA_SUCCESS;
+}
+if ((dest->cf|src->cf)&(INA_MEM_SHARED|INA_MEM_THREADLOCAL) ||
+    dest->snapshot != NULL || src->snapshot != NULL) {
+return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+}
+INA_MUST_SUCCEED(ina_list_remove(__pools, &src->node));
+src->cf |= INA_MEM_CHILD;
+
+/* append the chunks of src, its directory goes over to dest */
+for (pm = src; pm != NULL; pm = pm->child) {
+pm->seq += dest->nchunks;
+}
+src->parent = dest->tail;
+dest->tail->child = src;
+dest->tail = src->tail;
+dest->live = dest->tail;
+dest->nchunks += src->nchunks;
+dest->total_size += src->total_size;
+dest->retired_used += src->retired_used + __INA_CHUNK_USED(src->current);
+for (pm = src; pm != NULL; pm = pm->child) {
+if (pm->indexed || pm == src->current) {
+__ina_dir_push(dest, pm);
+}
+}
+src->dir = NULL;
+src->current = src;
+src->tail = NULL;
+src->live = NULL;
+src->bins = NULL;
+if (src->guards != NULL) {
+__ina_guard_t *g = src->guards;
+while (g->next != NULL) {
+g = g->next;
+}
+g->next = dest->guards;
+dest->guards = src->guards;
+src->guards = NULL;
+}
+return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_mempool_shrink(ina_mempool_t *pool, size_t chunks,
+        ina_mempool_info_t *info)
+{
+ina_mempool_t *pm;
+ina_mempool_t *pn;
+size_t c;
+
+INA_VERIFY_NOT_NULL(pool);
+INA_VERIFY_NOT_NULL(info);
+
+INA_RETURN_IF_FAILED(ina_mempool_info(pool, info));
+
+if (info->children <= chunks) {
+return INA_SUCCESS;
 }
 
+/* keep the pool itself and the first chunks children */
+c = 0;
+pm = pool;
+while (c < chunks) {
+pm = pm->child;
+++c;
+}
+pn = pm->child;
+pm->child = NULL;
+pool->tail = pm;
+while (pn != NULL) {
+pm = pn;
+pn = pn->child;
+--pool->nchunks;
+pool->total_size -= pm->size;
+__ina_chunk_release(pm);
 ina_mem_free(pm);
 }
+INA_RETURN_IF_FAILED(ina_mempool_reset(pool));
+return ina_mempool_info(pool, info);
+}
+
+INA_API(ina_rc_t) ina_mempool_clear(ina_mempool_t *pool)
+{
+ina_mempool_t *pm;
+ina_mempool_t *pn;
+
+INA_VERIFY_NOT_NULL(pool);
+
+pn = pool;
+pm = NULL;
+while (pn != NULL) {
+pm = pn;
+if (pn != pn->child) {
+pn = pn->child;
+}
+if (pm->cf&INA_MEM_SHARED) {
+__INA_SHM_HDR(pm)->pos = 0;
+__ina_mem_zero(&pm->m[pm->pos], pm->size - pm->pos);
+continue;
+}
+/* only the area used since the last zero fill is dirty */
+__ina_chunk_dirty(pm);
+__ina_chunk_zero(pm, __INA_CHUNK_BASE(pm), pm->hwm);
+__ina_chunk_zero(pm, INA_MAX(pm->lwm, pm->hwm), pm->size);
+pm->hwm = 0;
+pm->lwm = pm->size;
+pm->pos = __INA_CHUNK_BASE(pm);
+pm->end = pm->size;
+pm->claimed = 0;
+}
+if (pool->cf&INA_MEM_FILE) {
+__INA_FILE_HDR(pool)->root = 0;
+}
+__ina_guard_release(pool);
+pool->current = pool;
+pool->bins = NULL;
+pool->retired_used = 0;
+pool->barrier = 0;
+pool->mark = NULL;
+pool->live = pool;
+pool->dir = NULL;
+pool->indexed = 0;
+__ina_dir_rebuild(pool, pool->child, NULL);
+if (pool->cf&INA_MEM_THREADLOCAL) {
+pool->epoch = INA_ATOMIC_INC(&__epoch) + 1;
+}
+return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_mempool_reset(ina_mempool_t *pool)
+{
+ina_mempool_t *pm;
+ina_mempool_t *pn;
+
+INA_VERIFY_NOT_NULL(pool);
+
+pn = pool;
+pm = NULL;
+while (pn != NULL) {
+pm = pn;
+if (pn != pn->child) {
+pn = pn->child;
+}
+if (pm->cf&INA_MEM_SHARED) {
+__INA_SHM_HDR(pm)->pos = 0;
+continue;
+}
+if (pm->cf&INA_MEM_GUARD) {
+/* catch use after reset */
+ina_mem_set(pm->m, __INA_MEM_POISON, pm->pos);
+ina_mem_set(&pm->m[pm->end], __INA_MEM_POISON, pm->size - pm->end);
+} else if (pm->cf&(INA_MEM_MMAP|INA_MEM_HUGEPAGE)) {
+/* hand used pages back to the kernel */
+__ina_chunk_discard(pm, 0, pm->pos);
+__ina_chunk_discard(pm, pm->end, pm->size);
+}
+__ina_chunk_dirty(pm);
+pm->pos = __INA_CHUNK_BASE(pm);
+pm->end = pm->size;
+pm->claimed = 0;
+}
+if (pool->cf&INA_MEM_FILE) {
+__INA_FILE_HDR(pool)->root = 0;
+}
+__ina_guard_release(pool);
+pool->current = pool;
+pool->bins = NULL;
+pool->retired_used = 0;
+pool->barrier = 0;
+pool->mark = NULL;
+pool->live = pool;
+pool->dir = NULL;
+pool->indexed = 0;
+__ina_dir_rebuild(pool, pool->child, NULL);
+if (pool->cf&INA_MEM_THREADLOCAL) {
+/* chunks owned by threads are returned to the pool */
+pool->epoch = INA_ATOMIC_INC(&__epoch) + 1;
+}
+return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_mempool_sync(ina_mempool_t *pool)
+{
+INA_VERIFY_NOT_NULL(pool);
+
+if (!(pool->cf&INA_MEM_FILE)) {
+return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+}
+return __ina_file_sync(pool);
+}
+
+INA_API(ina_rc_t) ina_mempool_set_root(ina_mempool_t *pool, void *root)
+{
+INA_VERIFY_NOT_NULL(pool);
+
+if (!(pool->cf&INA_MEM_FILE)) {
+return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+}
+__INA_FILE_HDR(pool)->root = ina_mempool_ptr2off(pool, root);
+return INA_SUCCESS;
+}
+
+INA_API(void *) ina_mempool_get_root(ina_mempool_t *pool)
+{
+INA_ASSERT_NOT_NULL(pool);
+
+if (!(pool->cf&INA_MEM_FILE)) {
+return NULL;
+}
+return ina_mempool_off2ptr(pool, (size_t)__INA_FILE_HDR(pool)->root);
+}
+
+INA_API(size_t) ina_mempool_ptr2off(ina_mempool_t *pool, const void *ptr)
+{
+INA_ASSERT_NOT_NULL(pool);
+
+if (ptr == NULL) {
+return 0;
+}
+INA_ASSERT((const unsigned char*)ptr > pool->m &&
+           (const unsigned char*)ptr < pool->m + pool->size);
+return (size_t)((const unsigned char*)ptr - pool->m);
+}
+
+INA_API(void *) ina_mempool_off2ptr(ina_mempool_t *pool, size_t off)
+{
+INA_ASSERT_NOT_NULL(pool);
+
+if (off == 0) {
+return NULL;
+}
+INA_ASSERT(off < pool->size);
+return &pool->m[off];
+}
+
+INA_API(ina_rc_t) ina_mempool_set_node(ina_mempool_t *pool, int node)
+{
+ina_mempool_t *pm;
+
+INA_VERIFY_NOT_NULL(pool);
+INA_VERIFY(node >= INA_MEM_NODE_LOCAL && node < INA_MEM_MAX_NODES);
+
+if (pool->cf&(INA_MEM_SHARED|INA_MEM_FILE)) {
+return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+}
+/* existing chunks are moved */
+if (node != INA_MEM_NODE_ANY) {
+for (pm = pool; pm != NULL; pm = pm->child) {
+INA_RETURN_IF_FAILED(__ina_chunk_bind(pm, node, 1));
+}
+}
+pool->numa_node = node;
+return INA_SUCCESS;
 }
 
-INA_API(ina_rc_t) ina_mempool_merge(ina_mempool_t *dest, ina_mempool_t *src)
+INA_API(ina_rc_t) ina_mempool_node_usage(ina_mempool_t *pool, size_t *usage,
+        size_t nodes)
 {
-ina_mempool_t *first_child;
+ina_mempool_t *pm;
 
-INA_VERIFY_NOT_NULL(dest);
+INA_VERIFY_NOT_NULL(pool);
+INA_VERIFY_NOT_NULL(usage);
 
-if (src == NULL) {
+ina_mem_set(usage, 0, nodes*sizeof(size_t));
+for (pm = pool; pm != NULL; pm = pm->child) {
+INA_RETURN_IF_FAILED(__ina_chunk_nodes(pm, usage, nodes));
+}
 return INA_SUCCESS;
 }
-if (dest->cf&INA_MEM_SHARED || src->cf&INA_MEM_SHARED) {
-return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+
+INA_API(ina_rc_t) ina_mempool_set_limit(ina_mempool_t *pool, size_t limit,
+        ina_mempool_limit_fn_t limit_fn, void *arg)
+{
+INA_VERIFY_NOT_NULL(pool);
+
+pool->limit = limit;
+pool->limit_fn = limit_fn;
+pool->limit_arg = arg;
+return INA_SUCCESS;
 }
-src->parent = dest;
-first_child = dest->child;
-dest->child = src;
-src->child = first_child;
+
+INA_API(ina_rc_t) ina_mempool_set_global_limit(size_t limit,
+        ina_mempool_limit_fn_t limit_fn, void *arg)
+{
+__ina_limit_lock();
+__limit_fn = limit_fn;
+__limit_arg = arg;
+INA_ATOMIC_STORE(&__limit, (int64_t)limit);
+__ina_limit_unlock();
 return INA_SUCCESS;
 }
 
-INA_API(ina_rc_t) ina_mempool_shrink(ina_mempool_t *pool, size_t chunks,
-        ina_mempool_info_t *info)
+INA_API(ina_mempool_mark_t) ina_mempool_mark(ina_mempool_t *pool)
+{
+ina_mempool_mark_t mark;
+
+INA_ASSERT_NOT_NULL(pool);
+
+INA_MEM_SET_ZERO(&mark, ina_mempool_mark_t);
+if (pool->cf&(INA_MEM_SHARED|INA_MEM_THREADLOCAL)) {
+return mark;
+}
+mark.chunk = pool->current;
+mark.pos = pool->current->pos;
+mark.end = pool->current->end;
+mark.live = pool->live;
+mark.barrier = pool->barrier;
+mark.outer = pool->mark;
+mark.outer_pos = pool->mark_pos;
+/* free lists are kept aside, blocks freed after the mark go to new ones */
+mark.bins = pool->bins;
+pool->bins = NULL;
+pool->mark = pool->current;
+pool->mark_pos = pool->current->pos;
+/* chunks in use must not be filled while the mark is set */
+pool->barrier = pool->live->seq + 1;
+return mark;
+}
+
+INA_API(ina_rc_t) ina_mempool_release(ina_mempool_t *pool,
+        ina_mempool_mark_t mark)
 {
 ina_mempool_t *pm;
-ina_mempool_t *pn;
-size_t c;
+ina_mempool_t *last;
 
 INA_VERIFY_NOT_NULL(pool);
-INA_VERIFY_NOT_NULL(info);
 
-INA_RETURN_IF_FAILED(ina_mempool_info(pool, info));
+if (mark.chunk == NULL) {
+return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+}
+/* free lists of the released area are dropped, the older ones come back */
+pool->bins = mark.bins;
+pool->barrier = mark.barrier;
+pool->mark = mark.outer;
+pool->mark_pos = mark.outer_pos;
 
-if (info->children <= chunks) {
+if (pool->current != mark.chunk) {
+pool->retired_used -= __INA_CHUNK_USED(mark.chunk);
+__ina_dir_remove(pool, mark.chunk);
+}
+__ina_chunk_dirty(mark.chunk);
+mark.chunk->pos = mark.pos;
+mark.chunk->end = mark.end;
+if (pool->current == mark.chunk && pool->live == mark.live) {
 return INA_SUCCESS;
 }
 
-c = info->children;
-pn = pool;
-pm = NULL;
-while (pn != NULL) {
-pm = pn;
-if (pn != pn->child) {
-pn = pn->child;
+/* chunks taken into use after the mark are emptied and indexed again */
+last = pool->live;
+for (pm = mark.live->child; pm != last->child; pm = pm->child) {
+if (pm != pool->current) {
+pool->retired_used -= __INA_CHUNK_USED(pm);
 }
-if (c > chunks && pool->end == pool->size) {
-if (pm->cf&INA_MEM_SHARED) {
-__ina_shm_close(pm);
-} else {
-ina_mem_free(pm->m);
-}
-ina_mem_free(pm);
-} else {
+__ina_dir_remove(pool, pm);
+__ina_chunk_dirty(pm);
 pm->pos = 0;
+pm->end = pm->size;
 }
---c;
-}
+pool->current = mark.chunk;
+pool->live = mark.live;
+__ina_dir_rebuild(pool, mark.live->child, last->child);
 return INA_SUCCESS;
 }
 
-INA_API(ina_rc_t) ina_mempool_clear(ina_mempool_t *pool)
+INA_API(ina_rc_t) ina_mempool_snapshot(ina_mempool_t *pool,
+        ina_mempool_snapshot_t **snap)
 {
+ina_mempool_snapshot_chunk_t *c;
 ina_mempool_t *pm;
-ina_mempool_t *pn;
+ina_rc_t rc;
 
 INA_VERIFY_NOT_NULL(pool);
+INA_VERIFY_NOT_NULL(snap);
 
-pn = pool;
-pm = NULL;
-while (pn != NULL) {
-pm = pn;
-if (pn != pn->child) {
-pn = pn->child;
+if (!(pool->cf&INA_MEM_SNAPSHOT) || pool->snapshot != NULL) {
+return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
 }
-pm->pos = 0;
-ina_mem_set(pm->m, 0, pm->size);
+*snap = (ina_mempool_snapshot_t*)ina_mem_alloc(sizeof(ina_mempool_snapshot_t));
+INA_RETURN_IF_NULL(*snap);
+(*snap)->chunks = (ina_mempool_snapshot_chunk_t*)ina_mem_alloc(
+                      pool->nchunks*sizeof(ina_mempool_snapshot_chunk_t));
+if ((*snap)->chunks == NULL) {
+INA_MEM_FREE_SAFE(*snap);
+return INA_ERROR(INA_ERR_OUT_OF_MEMORY);
+}
+(*snap)->pool = pool;
+(*snap)->nchunks = 0;
+pool->snapshot = *snap;
+
+for (pm = pool; pm != NULL && (*snap)->nchunks < pool->nchunks; pm = pm->child) {
+c = &(*snap)->chunks[(*snap)->nchunks];
+if (INA_FAILED(__ina_snap_take(pm, &c->data))) {
+/* give back the chunks taken so far */
+rc = ina_err_get_rc();
+ina_mempool_snapshot_free(snap);
+return rc;
+}
+c->base = pm->m;
+c->size = pm->size;
+c->pos = pm->pos;
+c->end = pm->end;
+++(*snap)->nchunks;
 }
-pool->current = pool;
 return INA_SUCCESS;
 }
 
-INA_API(ina_rc_t) ina_mempool_reset(ina_mempool_t *pool)
+INA_API(const void *) ina_mempool_snapshot_ptr(const ina_mempool_snapshot_t *snap,
+        const void *ptr)
 {
-ina_mempool_t *pm;
-ina_mempool_t *pn;
+const ina_mempool_snapshot_chunk_t *c;
+const unsigned char *p = (const unsigned char*)ptr;
+size_t i;
 
-INA_VERIFY_NOT_NULL(pool);
+INA_ASSERT_NOT_NULL(snap);
 
-pn = pool;
-pm = NULL;
-while (pn != NULL) {
-pm = pn;
-if (pn != pn->child) {
-pn = pn->child;
+for (i = 0; i < snap->nchunks; ++i) {
+c = &snap->chunks[i];
+if (p >= c->base && p < c->base + c->size) {
+return c->data + (p - c->base);
 }
-pm->pos = 0;
 }
-pool->current = pool;
-return INA_SUCCESS;
+return NULL;
 }
 
+INA_API(void) ina_mempool_snapshot_free(ina_mempool_snapshot_t **snap)
+{
+ina_mempool_t *pm;
+size_t i;
+
+INA_VERIFY_FREE(snap);
+
+for (i = 0; i < (*snap)->nchunks; ++i) {
+__ina_snap_unview((*snap)->chunks[i].data, (*snap)->chunks[i].size);
+}
+if ((*snap)->pool != NULL) {
+for (pm = (*snap)->pool; pm != NULL; pm = pm->child) {
+if (pm->cow && INA_FAILED(__ina_snap_restore(pm))) {
+/* the chunk stays private, the next snapshot tries again */
+ina_err_reset();
+}
+}
+(*snap)->pool->snapshot = NULL;
+}
+ina_mem_free((*snap)->chunks);
+INA_MEM_FREE_SAFE(*snap);
+}
 
 INA_API(ina_rc_t) ina_mempool_info(ina_mempool_t *pool, ina_mempool_info_t *info)
 {
@@ -314,12 +2221,26 @@ INA_VERIFY_NOT_NULL(info);
 
 pm = pool;
 
+info->cf = pm->cf;
+info->node = pm->numa_node;
+if (!(pm->cf&(INA_MEM_SHARED|INA_MEM_THREADLOCAL))) {
+info->size = pool->total_size;
+info->used = pool->retired_used + __INA_CHUNK_USED(pool->current);
+info->children = pool->nchunks - 1;
+return INA_SUCCESS;
+}
+
+/* chunks are in use by several threads, sum them up */
 info->size = 0;
 info->used = 0;
 info->children = 0;
-info->cf = pm->cf;
 while (pm != NULL) {
 info->size += pm->size;
+if (pm->cf&INA_MEM_SHARED) {
+info->used += INA_MIN(pm->pos + (size_t)__INA_SHM_HDR(pm)->pos, pm->size);
+pm = pm->child;
+continue;
+}
 info->used += pm->pos + (pm->size-pm->end);
 ++info->children;
 pm = pm->child;
@@ -331,47 +2252,145 @@ return INA_SUCCESS;
 INA_API(void *) ina_mempool_dalloc(ina_mempool_t *pool, size_t size)
 {
 void *ret;
-size_t nsize;
 
 INA_ASSERT_NOT_NULL(pool);
 INA_ASSERT_NOT_NULL(pool->current);
 
 ret = NULL;
-if (pool->cf^INA_MEM_BESTFIT) {
-size = INA_MEM_ALIGN(size);
-}
+size = __ina_mempool_size(pool, size);
 
-retry:
+if (__INA_GUARDED(pool, size)) {
+return __ina_guard_alloc(pool, size, __INA_GUARD_ALIGN(pool));
+}
+if (pool->cf&INA_MEM_THREADLOCAL) {
+int shared;
+ina_mempool_t *pm = __ina_mempool_tl_chunk(pool, size, &shared);
+if (pm == NULL) {
+return NULL;
+}
+ret = &pm->m[pm->pos];
+pm->pos += size;
+if (shared) {
+__ina_mempool_unlock(pool);
+}
+return ret;
+}
+if (pool->cf&INA_MEM_SHARED) {
+return __ina_shm_alloc(pool, size);
+}
+if (pool->bins != NULL && (ret = __ina_free_take(pool, pool->bins, size)) != NULL) {
+return ret;
+}
 
 if ((pool->current->pos + size > pool->current->end) ||
 (pool->current->pos + size < pool->current->pos)) {
-if (pool->cf&INA_MEM_DYNAMIC) {
-nsize = 0;
-
-if (pool->cf&INA_MEM_AUTOSIZE || size > pool->size) {
-nsize = size;
-} else {
-nsize = pool->size;
+if (__ina_mempool_next_chunk(pool, size) == NULL) {
+return NULL;
+}
 }
+ret = &pool->current->m[pool->current->pos];
+pool->current->pos += size;
+return ret;
+}
+
+INA_API(void *) ina_mempool_dalloc_aligned(ina_mempool_t *pool, size_t size,
+        size_t alignment)
+{
+ina_mempool_t *pm;
+size_t pad;
+int shared = 0;
+
+INA_ASSERT_NOT_NULL(pool);
+INA_ASSERT_NOT_NULL(pool->current);
 
-/* FXIME: shm can not handled in chunks ! */
-if (INA_FAILED(ina_mempool_new(nsize,
-                               pool->label,
-pool->cf | INA_MEM_CHILD, &pool->current->child))) {
+if (INA_UNLIKELY(alignment == 0 || (alignment & (alignment - 1)) != 0)) {
+INA_ERROR(INA_ERR_INVALID_ARGUMENT);
 return NULL;
 }
-pool->current->child->parent = pool->current;
-pool->current = pool->current->child;
+if (alignment <= INA_MEM_ALIGN_SIZE ||
+    (pool->cf&INA_MEM_CACHEALIGN && alignment <= INA_MEM_CACHELINE_SIZE)) {
+return ina_mempool_dalloc(pool, size);
+}
+size = __ina_mempool_size(pool, size);
+
+if (__INA_GUARDED(pool, size) && alignment <= INA_MEM_GUARD_SIZE) {
+return __ina_guard_alloc(pool, size, alignment);
+}
+if (pool->cf&INA_MEM_SHARED) {
+return __ina_shm_alloc_aligned(pool, size, alignment);
+}
+if (pool->cf&INA_MEM_THREADLOCAL) {
+pm = __ina_mempool_tl_chunk(pool, size + alignment - 1, &shared);
 } else {
-INA_ERROR(INA_ERR_POOL_FULL);
+pm = pool->current;
+pad = (alignment - ((uintptr_t)&pm->m[pm->pos] & (alignment - 1))) & (alignment - 1);
+if ((pm->pos + pad + size > pm->end) || (pm->pos + pad + size < pm->pos)) {
+pm = __ina_mempool_next_chunk(pool, size + alignment - 1);
+}
+}
+if (pm == NULL) {
 return NULL;
 }
+/* the padding is skipped, pm->pos stays aligned to the pool alignment */
+pad = (alignment - ((uintptr_t)&pm->m[pm->pos] & (alignment - 1))) & (alignment - 1);
+pm->pos += pad + size;
+if (shared) {
+__ina_mempool_unlock(pool);
 }
-ret = &pool->current->m[pool->current->pos];
-pool->current->pos += size;
-return ret;
+return &pm->m[pm->pos - size];
+}
+
+INA_API(void) ina_mempool_dfree(ina_mempool_t *pool, void *ptr, size_t size)
+{
+ina_mempool_t *pm;
+
+INA_ASSERT_NOT_NULL(pool);
+
+if (ptr == NULL || size == 0) {
+return;
+}
+if (pool->cf&INA_MEM_GUARD) {
+__ina_guard_free(pool, ptr, size);
+return;
 }
+if (pool->cf&(INA_MEM_SHARED|INA_MEM_THREADLOCAL)) {
+return;
+}
+size = __ina_mempool_size(pool, size);
 
+/* blocks allocated before a mark are kept until it is released */
+if (!__ina_mempool_after_mark(pool, ptr)) {
+return;
+}
+/* last allocation, just roll back */
+pm = pool->current;
+if (pm->pos >= size && &pm->m[pm->pos - size] == ptr) {
+__ina_chunk_dirty(pm);
+pm->pos -= size;
+/* a free block in front goes back to the chunk as well */
+if (pool->bins != NULL) {
+__ina_free_block_t *prev = __ina_free_find(pool->bins, &pm->m[pm->pos], 1);
+if (prev != NULL && (unsigned char*)prev >= &pm->m[__INA_CHUNK_BASE(pm)]) {
+__ina_free_remove(pool->bins, prev);
+pm->pos -= prev->size;
+}
+}
+return;
+}
+if (size < sizeof(__ina_free_block_t)) {
+return;
+}
+if (pool->bins == NULL) {
+pool->bins = (__ina_free_lists_t*)ina_mempool_nalloc(pool, sizeof(__ina_free_lists_t));
+if (pool->bins == NULL) {
+/* block stays allocated until reset */
+ina_err_reset();
+return;
+}
+INA_MEM_SET_ZERO(pool->bins, __ina_free_lists_t);
+}
+__ina_free_push(pool, pool->bins, ptr, size);
+}
 
 INA_API(void *) ina_mempool_nalloc(ina_mempool_t *pool, size_t size)
 {
@@ -381,35 +2400,37 @@ INA_ASSERT_NOT_NULL(pool);
 INA_ASSERT_NOT_NULL(pool->current);
 ret = NULL;
 
-if (pool->cf^INA_MEM_BESTFIT) {
-size = INA_MEM_ALIGN(size);
-}
+size = __ina_mempool_size(pool, size);
 
+if (__INA_GUARDED(pool, size)) {
+return __ina_guard_alloc(pool, size, __INA_GUARD_ALIGN(pool));
+}
 /* bogus request */
 if (pool->end < size) {
 INA_ERROR(INA_ES_SIZE | INA_ERR_INVALID);
 return NULL;
 }
 
-if ((pool->current->pos + size > pool->current->end) ||
-(pool->current->pos + size < pool->current->pos)) {
-if (pool->cf&INA_MEM_DYNAMIC) {
-size_t nsize = 0;
-
-if (pool->cf&INA_MEM_AUTOSIZE || size > pool->size) {
-nsize = size;
-} else {
-nsize = pool->size;
+if (pool->cf&INA_MEM_THREADLOCAL) {
+int shared;
+ina_mempool_t *pm = __ina_mempool_tl_chunk(pool, size, &shared);
+if (pm == NULL) {
+return NULL;
+}
+pm->end -= size;
+ret = &pm->m[pm->end];
+if (shared) {
+__ina_mempool_unlock(pool);
+}
+return ret;
+}
+if (pool->cf&INA_MEM_SHARED) {
+return __ina_shm_alloc(pool, size);
 }
 
-/* FIXME: shm can not handled in chunks ! */
-ina_mempool_new(nsize,
-        pool->label,
-pool->cf | INA_MEM_CHILD, &pool->current->child);
-pool->current->child->parent = pool->current;
-pool->current = pool->current->child;
-} else {
-INA_ERROR(INA_ERR_POOL_FULL);
+if ((pool->current->pos + size > pool->current->end) ||
+(pool->current->pos + size < pool->current->pos)) {
+if (__ina_mempool_next_chunk(pool, size) == NULL) {
 return NULL;
 }
 }
@@ -421,6 +2442,7 @@ return ret;
 INA_API(void *) ina_mempool_ralloc(ina_mempool_t *pool, void *old,
         size_t old_size, size_t new_size)
 {
+ina_mempool_t *pm;
 void *ret;
 
 INA_ASSERT_NOT_NULL(pool);
@@ -430,89 +2452,93 @@ INA_ASSERT(new_size > 0);
 INA_ASSERT_NOT_NULL(pool->current);
 
 
-if (pool->cf^INA_MEM_BESTFIT) {
-new_size = INA_MEM_ALIGN(new_size);
-old_size = INA_MEM_ALIGN(old_size);
-}
+new_size = __ina_mempool_size(pool, new_size);
+old_size = __ina_mempool_size(pool, old_size);
 
+if (__INA_GUARDED(pool, new_size)) {
+/* the old block becomes inaccessible */
+ret = ina_mempool_dalloc(pool, new_size);
+if (ret != NULL) {
+__ina_mem_relocate(ret, old, INA_MIN(old_size, new_size));
+__ina_guard_free(pool, old, old_size);
+}
+return ret;
+}
 /* bogus request */
 if (pool->end < old_size) {
 INA_ERROR(INA_ES_SIZE | INA_ERR_INVALID);
 return NULL;
 }
+if (pool->cf&INA_MEM_THREADLOCAL) {
+int shared;
+pm = __ina_mempool_tl_chunk(pool, 0, &shared);
+if (pm != NULL && pm->pos >= old_size && &pm->m[pm->pos - old_size] == old &&
+    pm->pos + new_size - old_size <= pm->end) {
+__ina_chunk_dirty(pm);
+pm->pos += new_size - old_size;
+if (shared) {
+__ina_mempool_unlock(pool);
+}
+return old;
+}
+if (shared) {
+__ina_mempool_unlock(pool);
+}
+ret = ina_mempool_dalloc(pool, new_size);
+if (ret != NULL) {
+__ina_mem_relocate(ret, old, INA_MIN(old_size, new_size));
+}
+return ret;
+}
+if (pool->cf&INA_MEM_SHARED) {
+__ina_shm_hdr_t *hdr = __INA_SHM_HDR(pool);
+int64_t off = (unsigned char*)old - &pool->m[pool->pos];
+/* last allocation, try to move the shared cursor */
+if (pool->pos + (size_t)off + new_size <= pool->end &&
+    INA_ATOMIC_SWAP(&hdr->pos, off + (int64_t)old_size,
+                    off + (int64_t)new_size) == off + (int64_t)old_size) {
+return old;
+}
+ret = __ina_shm_alloc(pool, new_size);
+if (ret != NULL) {
+__ina_mem_relocate(ret, old, INA_MIN(old_size, new_size));
+}
+return ret;
+}
 /* was the previous allocation - optimize! */
-if ((pool->pos >= old_size) && (&pool->m[pool->pos - old_size] == old)) {
+pm = pool->current;
+if ((pm->pos >= old_size) && (&pm->m[pm->pos - old_size] == old)) {
+/* a block before a mark is not shrunk below it */
+if (new_size < old_size && !__ina_mempool_after_mark(pool, old)) {
+return old;
+}
 /* fits */
-if (pool->pos + new_size - old_size <= pool->end) {
+if (pm->pos + new_size - old_size <= pm->end) {
 /* shrinking - zero again! */
-pool->pos += new_size - old_size;
+pm->pos += new_size - old_size;
 if (new_size < old_size) {
-ina_mem_set(&pool->m[pool->pos], 0, old_size - new_size);
+ina_mem_set(&pm->m[pm->pos], 0, old_size - new_size);
 }
 return old;
 }
-/* does not fit */
-if (pool->cf&INA_MEM_DYNAMIC) {
-size_t nsize = 0;
-
-if (pool->cf&INA_MEM_AUTOSIZE || new_size > pool->size) {
-nsize = new_size;
-} else {
-nsize = pool->size;
-}
-
-/* FIXME: Push an error , if fails */
-/* FIXME: shm can not handled in chunks ! */
-ina_mempool_new(nsize,
-        pool->label,
-pool->cf | INA_MEM_CHILD, &pool->current->child);
-pool->current->child->parent = pool->current;
-pool->current = pool->current->child;
-ret = &pool->m[pool->pos];
-ina_mem_cpy(ret, old, old_size);
-pool->pos += new_size;
-return ret;
-}
-INA_ERROR(INA_ERR_OUT_OF_MEMORY);
-return NULL;
+} else if (new_size <= old_size) {
+/* the cut off tail goes to the free lists */
+if (old_size - new_size >= sizeof(__ina_free_block_t)) {
+ina_mempool_dfree(pool, (unsigned char*)old + new_size, old_size - new_size);
 }
-/* cannot shrink, we need to move */
-if (new_size <= old_size) {
+return old;
+} else if (pool->bins != NULL &&
+           __ina_free_grow(pool, pool->bins, old, old_size, new_size)) {
 return old;
 }
-/* fits */
-if ((pool->pos + new_size >= pool->pos) &&
-(pool->pos + new_size <= pool->end))
-{
-ret = &pool->m[pool->pos];
-ina_mem_cpy(ret, old, old_size);
-pool->pos += new_size;
-return ret;
+/* does not fit, move and recycle the old block */
+ret = ina_mempool_dalloc(pool, new_size);
+if (ret != NULL) {
+__ina_mem_relocate(ret, old, INA_MIN(old_size, new_size));
+ina_mempool_dfree(pool, old, old_size);
 }
-if (pool->cf&INA_MEM_DYNAMIC) {
-size_t nsize = 0;
-
-if (pool->cf&INA_MEM_AUTOSIZE || new_size > pool->size) {
-nsize = new_size;
-} else {
-nsize = pool->size;
-}
-
-/* FIXME: Push an error , if fails */
-/* FIXME: shm can not handled in chunks ! */
-ina_mempool_new(nsize,
-        pool->label,
-pool->cf | INA_MEM_CHILD, &pool->current->child);
-pool->current->child->parent = pool->current;
-pool->current = pool->current->child;
-ret = &pool->m[pool->pos];
-ina_mem_cpy(ret, old, old_size);
-pool->pos += new_size;
 return ret;
 }
-INA_ERROR(INA_ERR_POOL_FULL);
-return NULL;
-}
 
 
 #ifndef INA_OS_WIN32
@@ -528,7 +2554,7 @@ __ina_shm_open(ina_mempool_t *pool)
     INA_ASSERT(pool->cf&INA_MEM_SHARED);
     INA_ASSERT_NULL(pool->m);
 
-    pool->size = INA_MEM_ALIGN(pool->size+sizeof(int64_t));
+    pool->size = INA_MEM_ALIGN(pool->size+__INA_SHM_HDR_SIZE);
     pool->end = pool->size;
 
     flags = O_RDWR;
@@ -554,25 +2580,184 @@ __ina_shm_open(ina_mempool_t *pool)
         }
     }
 
-    pool->m = (void *)mmap(NULL, pool->size, PROT_READ|PROT_WRITE,
-                           MAP_SHARED,
-                           pool->shm_handle, 0);
+    pool->m = (void *)mmap(NULL, pool->size, PROT_READ|PROT_WRITE,
+                           MAP_SHARED,
+                           pool->shm_handle, 0);
+
+    if (pool->m == MAP_FAILED) {
+        INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
+        close(pool->shm_handle);
+        pool->shm_handle = 0;
+        if (pool->cf&INA_MEM_SHARED_EXCL) {
+            shm_unlink(ina_str_cstr(pool->label));
+        }
+        return ina_err_get_rc();
+    }
+    /* Inc ref count */
+    INA_ATOMIC_INC(&__INA_SHM_HDR(pool)->refcount);
+    /* Allocations start behind the header */
+    pool->pos = __INA_SHM_HDR_SIZE;
+    INA_TRACE2("shared mem %s ref count =  %" INA_INT64_T_FMT, pool->label, __INA_SHM_HDR(pool)->refcount);
+    return INA_SUCCESS;
+}
+
+static ina_rc_t
+__ina_chunk_map(ina_mempool_t *pool)
+{
+    size_t align;
+    unsigned char *m;
+
+    INA_ASSERT_NOT_NULL(pool);
+    INA_ASSERT_NULL(pool->m);
+
+    if (pool->cf&INA_MEM_SNAPSHOT) {
+        return __ina_snap_map(pool);
+    }
+    if (pool->cf&INA_MEM_HUGEPAGE) {
+        align = INA_MEM_HUGEPAGE_SIZE;
+    } else {
+        ina_mem_get_pagesize(&align);
+    }
+    pool->size = (pool->size + align - 1) & ~(align - 1);
+    pool->end = pool->size;
+    pool->lwm = pool->size;
+
+    /* over-map in order to align the chunk to the (huge) page size */
+    m = (unsigned char*)mmap(NULL, pool->size + align, PROT_READ|PROT_WRITE,
+                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        INA_OS_ERROR(INA_ES_MEMORY | INA_ERR_OUT_OF);
+        return ina_err_get_rc();
+    }
+    pool->m = (unsigned char*)(((uintptr_t)m + align - 1) & ~(align - 1));
+    if (pool->m != m) {
+        munmap(m, pool->m - m);
+    }
+    munmap(pool->m + pool->size, align - (pool->m - m));
+
+#ifdef MADV_HUGEPAGE
+    if (pool->cf&INA_MEM_HUGEPAGE) {
+        madvise(pool->m, pool->size, MADV_HUGEPAGE);
+    }
+#endif
+    return INA_SUCCESS;
+}
+
+static void
+__ina_chunk_unmap(ina_mempool_t *pool)
+{
+    INA_ASSERT_NOT_NULL(pool);
+    if (pool->m != NULL) {
+        munmap(pool->m, pool->size);
+    }
+    if (pool->cf&INA_MEM_SNAPSHOT) {
+        close(pool->shm_handle);
+    }
+}
+
+static void
+__ina_chunk_discard(ina_mempool_t *pool, size_t from, size_t to)
+{
+    size_t pagesize;
+
+    ina_mem_get_pagesize(&pagesize);
+    from = (from + pagesize - 1) & ~(pagesize - 1);
+    to &= ~(pagesize - 1);
+    if (from >= to) {
+        return;
+    }
+    if (pool->cf&INA_MEM_SNAPSHOT) {
+        /* dropped pages of a private mapping would read the file again */
+        if (pool->cow) {
+            ina_mem_set(pool->m + from, 0, to - from);
+        } else {
+#ifdef MADV_REMOVE
+            madvise(pool->m + from, to - from, MADV_REMOVE);
+#else
+            ina_mem_set(pool->m + from, 0, to - from);
+#endif
+        }
+        return;
+    }
+    madvise(pool->m + from, to - from, MADV_DONTNEED);
+}
+
+static unsigned char *
+__ina_guard_map(size_t len)
+{
+    size_t pagesize;
+    unsigned char *m;
+
+    ina_mem_get_pagesize(&pagesize);
+    m = (unsigned char*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    mprotect(m + len - pagesize, pagesize, PROT_NONE);
+    return m;
+}
+
+static void
+__ina_guard_unmap(unsigned char *m, size_t len)
+{
+    munmap(m, len);
+}
+
+static void
+__ina_guard_protect(unsigned char *m, size_t len)
+{
+    mprotect(m, len, PROT_NONE);
+}
+
+static void *
+__ina_mem_map(size_t alignment, size_t size)
+{
+    unsigned char *m;
+    unsigned char *p;
+    size_t len;
+    size_t pagesize;
+
+    ina_mem_get_pagesize(&pagesize);
+    /* over-map and trim to the alignment */
+    len = size + alignment - pagesize;
+    m = (unsigned char*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    p = (unsigned char*)(((uintptr_t)m + alignment - 1) & ~(alignment - 1));
+    if (p != m) {
+        munmap(m, p - m);
+    }
+    if (p + size != m + len) {
+        munmap(p + size, (m + len) - (p + size));
+    }
+    return p;
+}
+
+static void
+__ina_mem_unmap(void *ptr, size_t size)
+{
+    munmap(ptr, size);
+}
 
-    if (pool->m == MAP_FAILED) {
-        INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
-        close(pool->shm_handle);
-        pool->shm_handle = 0;
-        if (pool->cf&INA_MEM_SHARED_EXCL) {
-            shm_unlink(ina_str_cstr(pool->label));
-        }
-        return ina_err_get_rc();
+static void *
+__ina_mem_remap(void *ptr, size_t old_size, size_t size, int move)
+{
+#ifdef MREMAP_MAYMOVE
+    void *p;
+
+    p = mremap(ptr, old_size, size, move ? MREMAP_MAYMOVE : 0);
+    return p == MAP_FAILED ? NULL : p;
+#else
+    INA_UNUSED(move);
+    if (size < old_size) {
+        munmap((unsigned char*)ptr + size, old_size - size);
+        return ptr;
     }
-    /* Inc ref count */
-    __sync_fetch_and_add((int64_t*)pool->m, 1);
-    /* Inc start pos */
-    pool->pos += sizeof(int64_t);
-    INA_TRACE2("shared mem %s ref count =  %" INA_INT64_T_FMT, pool->label, *(int64_t*)pool->m);
-    return INA_SUCCESS;
+    return NULL;
+#endif
 }
 
 static ina_rc_t
@@ -588,7 +2773,7 @@ __ina_shm_close(ina_mempool_t *pool)
     }
 
     /* Dec an get ref count before unmap memory */
-    cn = __sync_sub_and_fetch((int64_t*)pool->m, 1);
+    cn = INA_ATOMIC_DEC(&__INA_SHM_HDR(pool)->refcount) - 1;
 
     /* Unmap memory */
     munmap(pool->m, pool->size);
@@ -610,6 +2795,110 @@ __ina_shm_close(ina_mempool_t *pool)
 
     return INA_SUCCESS;
 }
+static ina_rc_t
+__ina_file_open(ina_mempool_t *pool)
+{
+    __ina_file_hdr_t *hdr;
+    struct stat st;
+    int fd;
+    int created;
+
+    INA_ASSERT_NOT_NULL(pool);
+    INA_ASSERT_NOT_NULL(pool->label);
+    INA_ASSERT(pool->cf&INA_MEM_FILE);
+    INA_ASSERT_NULL(pool->m);
+
+    fd = open(ina_str_cstr(pool->label), O_RDWR|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (fd == -1) {
+        return INA_OS_ERROR(INA_ES_FILE | INA_ERR_INVALID);
+    }
+    if (fstat(fd, &st) == -1) {
+        INA_OS_ERROR(INA_ES_FILE | INA_ERR_FAILED);
+        close(fd);
+        return ina_err_get_rc();
+    }
+    created = st.st_size == 0;
+    if (created) {
+        pool->size = INA_MEM_ALIGN_TO(pool->size+__INA_FILE_HDR_SIZE, INA_MEM_CACHELINE_SIZE);
+        if (ftruncate(fd, (off_t)pool->size) == -1) {
+            INA_OS_ERROR(INA_ES_FILE | INA_ERR_FAILED);
+            close(fd);
+            return ina_err_get_rc();
+        }
+    } else if ((size_t)st.st_size < __INA_FILE_HDR_SIZE) {
+        close(fd);
+        return INA_ERROR(INA_ES_FILE | INA_ERR_INVALID);
+    } else {
+        pool->size = (size_t)st.st_size;
+    }
+
+    pool->m = (unsigned char *)mmap(NULL, pool->size, PROT_READ|PROT_WRITE,
+                                    MAP_SHARED, fd, 0);
+    /* the mapping keeps the file open */
+    close(fd);
+    if (pool->m == MAP_FAILED) {
+        pool->m = NULL;
+        return INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
+    }
+
+    hdr = __INA_FILE_HDR(pool);
+    if (created) {
+        hdr->magic = __INA_FILE_MAGIC;
+        hdr->version = __INA_FILE_VERSION;
+        hdr->hdr_size = __INA_FILE_HDR_SIZE;
+        hdr->size = pool->size;
+        hdr->pos = __INA_FILE_HDR_SIZE;
+        hdr->end = pool->size;
+        hdr->root = 0;
+    } else if (hdr->magic != __INA_FILE_MAGIC ||
+               hdr->hdr_size != __INA_FILE_HDR_SIZE ||
+               hdr->size != pool->size ||
+               hdr->pos < __INA_FILE_HDR_SIZE || hdr->pos > hdr->end ||
+               hdr->end > hdr->size || hdr->root >= hdr->size) {
+        munmap(pool->m, pool->size);
+        pool->m = NULL;
+        return INA_ERROR(INA_ES_FILE | INA_ERR_INVALID);
+    } else if (hdr->version != __INA_FILE_VERSION) {
+        munmap(pool->m, pool->size);
+        pool->m = NULL;
+        return INA_ERROR(INA_ES_VERSION | INA_ERR_INVALID);
+    }
+    pool->pos = (size_t)hdr->pos;
+    pool->end = (size_t)hdr->end;
+    pool->hwm = pool->pos;
+    pool->lwm = pool->end;
+    return INA_SUCCESS;
+}
+
+static ina_rc_t
+__ina_file_sync(ina_mempool_t *pool)
+{
+    INA_ASSERT_NOT_NULL(pool);
+    INA_ASSERT_NOT_NULL(pool->m);
+
+    __INA_FILE_HDR(pool)->pos = pool->pos;
+    __INA_FILE_HDR(pool)->end = pool->end;
+    if (msync(pool->m, pool->size, MS_SYNC) == -1) {
+        return INA_OS_ERROR(INA_ES_FILE | INA_ERR_FAILED);
+    }
+    return INA_SUCCESS;
+}
+
+static void
+__ina_file_close(ina_mempool_t *pool)
+{
+    INA_ASSERT_NOT_NULL(pool);
+
+    if (pool->m == NULL) {
+        return;
+    }
+    /* dirty pages are written back by the kernel after unmap */
+    __INA_FILE_HDR(pool)->pos = pool->pos;
+    __INA_FILE_HDR(pool)->end = pool->end;
+    munmap(pool->m, pool->size);
+    pool->m = NULL;
+    ina_str_free(pool->label);
+}
 #else
 static ina_rc_t
     __ina_shm_open(ina_mempool_t *pool)
@@ -620,6 +2909,9 @@ static ina_rc_t
         INA_ASSERT(pool->cf&INA_MEM_SHARED);
         INA_ASSERT_NULL(pool->m);
 
+        pool->size = INA_MEM_ALIGN(pool->size+__INA_SHM_HDR_SIZE);
+        pool->end = pool->size;
+
         pool->shm_handle = CreateFileMapping(
             INVALID_HANDLE_VALUE,
             NULL,
@@ -642,9 +2934,117 @@ static ina_rc_t
             pool->shm_handle = NULL;
             return INA_OS_ERROR(INA_ES_OPERATION|INA_ERR_FAILED);
         }
+        INA_ATOMIC_INC(&__INA_SHM_HDR(pool)->refcount);
+        pool->pos = __INA_SHM_HDR_SIZE;
+        return INA_SUCCESS;
+    }
+
+    static ina_rc_t
+    __ina_chunk_map(ina_mempool_t *pool)
+    {
+        size_t pagesize;
+
+        INA_ASSERT_NOT_NULL(pool);
+        INA_ASSERT_NULL(pool->m);
+
+        if (pool->cf&INA_MEM_SNAPSHOT) {
+            return INA_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+        }
+        /* large pages need SeLockMemoryPrivilege, use normal pages */
+        ina_mem_get_pagesize(&pagesize);
+        pool->size = (pool->size + pagesize - 1) & ~(pagesize - 1);
+        pool->end = pool->size;
+        pool->lwm = pool->size;
+        pool->m = (unsigned char*)VirtualAlloc(NULL, pool->size,
+                                               MEM_RESERVE|MEM_COMMIT,
+                                               PAGE_READWRITE);
+        if (pool->m == NULL) {
+            return INA_OS_ERROR(INA_ES_MEMORY|INA_ERR_OUT_OF);
+        }
         return INA_SUCCESS;
     }
 
+    static void
+    __ina_chunk_unmap(ina_mempool_t *pool)
+    {
+        INA_ASSERT_NOT_NULL(pool);
+        if (pool->m != NULL) {
+            VirtualFree(pool->m, 0, MEM_RELEASE);
+        }
+    }
+
+    static void
+    __ina_chunk_discard(ina_mempool_t *pool, size_t from, size_t to)
+    {
+        size_t pagesize;
+
+        ina_mem_get_pagesize(&pagesize);
+        from = (from + pagesize - 1) & ~(pagesize - 1);
+        to &= ~(pagesize - 1);
+        if (from < to) {
+            /* decommit and commit again, pages come back zero filled */
+            VirtualFree(pool->m + from, to - from, MEM_DECOMMIT);
+            VirtualAlloc(pool->m + from, to - from, MEM_COMMIT, PAGE_READWRITE);
+        }
+    }
+
+    static unsigned char *
+    __ina_guard_map(size_t len)
+    {
+        size_t pagesize;
+        unsigned char *m;
+        DWORD old;
+
+        ina_mem_get_pagesize(&pagesize);
+        m = (unsigned char*)VirtualAlloc(NULL, len, MEM_RESERVE|MEM_COMMIT,
+                                         PAGE_READWRITE);
+        if (m == NULL) {
+            return NULL;
+        }
+        VirtualProtect(m + len - pagesize, pagesize, PAGE_NOACCESS, &old);
+        return m;
+    }
+
+    static void
+    __ina_guard_unmap(unsigned char *m, size_t len)
+    {
+        INA_UNUSED(len);
+        VirtualFree(m, 0, MEM_RELEASE);
+    }
+
+    static void
+    __ina_guard_protect(unsigned char *m, size_t len)
+    {
+        DWORD old;
+        VirtualProtect(m, len, PAGE_NOACCESS, &old);
+    }
+
+    /* aligned blocks stay on the heap (_aligned_malloc) */
+    static void *
+    __ina_mem_map(size_t alignment, size_t size)
+    {
+        INA_UNUSED(alignment);
+        INA_UNUSED(size);
+        return NULL;
+    }
+
+    static void
+    __ina_mem_unmap(void *ptr, size_t size)
+    {
+        INA_UNUSED(size);
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+
+    static void *
+    __ina_mem_remap(void *ptr, size_t old_size, size_t size, int move)
+    {
+        INA_UNUSED(ptr);
+        INA_UNUSED(old_size);
+        INA_UNUSED(size);
+        INA_UNUSED(move);
+        return NULL;
+    }
+
     static ina_rc_t
     __ina_shm_close(ina_mempool_t *pool)
     {
@@ -657,6 +3057,8 @@ static ina_rc_t
              return INA_SUCCESS;
         }
 
+        INA_ATOMIC_DEC(&__INA_SHM_HDR(pool)->refcount);
+
         /* TODO: Error handling */
         UnmapViewOfFile(pool->shm_handle);
         CloseHandle(pool->shm_handle);
@@ -669,4 +3071,401 @@ static ina_rc_t
 
         return INA_SUCCESS;
     }
+
+    static ina_rc_t
+    __ina_file_open(ina_mempool_t *pool)
+    {
+        __ina_file_hdr_t *hdr;
+        HANDLE fh;
+        LARGE_INTEGER fsize;
+        int created;
+
+        INA_ASSERT_NOT_NULL(pool);
+        INA_ASSERT_NOT_NULL(pool->label);
+        INA_ASSERT(pool->cf&INA_MEM_FILE);
+        INA_ASSERT_NULL(pool->m);
+
+        fh = CreateFileA(ina_str_cstr(pool->label), GENERIC_READ|GENERIC_WRITE,
+                         FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fh == INVALID_HANDLE_VALUE) {
+            return INA_OS_ERROR(INA_ES_FILE|INA_ERR_INVALID);
+        }
+        if (!GetFileSizeEx(fh, &fsize)) {
+            INA_OS_ERROR(INA_ES_FILE|INA_ERR_FAILED);
+            CloseHandle(fh);
+            return ina_err_get_rc();
+        }
+        created = fsize.QuadPart == 0;
+        if (created) {
+            pool->size = INA_MEM_ALIGN_TO(pool->size+__INA_FILE_HDR_SIZE, INA_MEM_CACHELINE_SIZE);
+        } else if ((size_t)fsize.QuadPart < __INA_FILE_HDR_SIZE) {
+            CloseHandle(fh);
+            return INA_ERROR(INA_ES_FILE|INA_ERR_INVALID);
+        } else {
+            pool->size = (size_t)fsize.QuadPart;
+        }
+
+        /* the mapping extends a new file and keeps it open */
+        pool->shm_handle = CreateFileMapping(fh, NULL, PAGE_READWRITE,
+                                             INA_HIGH32(pool->size),
+                                             INA_LOW32(pool->size), NULL);
+        CloseHandle(fh);
+        if (pool->shm_handle == NULL) {
+            return INA_OS_ERROR(INA_ES_OPERATION|INA_ERR_FAILED);
+        }
+        pool->m = (void*)MapViewOfFile(pool->shm_handle, FILE_MAP_ALL_ACCESS,
+                                       0, 0, pool->size);
+        if (pool->m == NULL) {
+            CloseHandle(pool->shm_handle);
+            pool->shm_handle = NULL;
+            return INA_OS_ERROR(INA_ES_OPERATION|INA_ERR_FAILED);
+        }
+
+        hdr = __INA_FILE_HDR(pool);
+        if (created) {
+            hdr->magic = __INA_FILE_MAGIC;
+            hdr->version = __INA_FILE_VERSION;
+            hdr->hdr_size = __INA_FILE_HDR_SIZE;
+            hdr->size = pool->size;
+            hdr->pos = __INA_FILE_HDR_SIZE;
+            hdr->end = pool->size;
+            hdr->root = 0;
+        } else if (hdr->magic != __INA_FILE_MAGIC ||
+                   hdr->hdr_size != __INA_FILE_HDR_SIZE ||
+                   hdr->size != pool->size ||
+                   hdr->pos < __INA_FILE_HDR_SIZE || hdr->pos > hdr->end ||
+                   hdr->end > hdr->size || hdr->root >= hdr->size ||
+                   hdr->version != __INA_FILE_VERSION) {
+            UnmapViewOfFile(pool->m);
+            CloseHandle(pool->shm_handle);
+            pool->m = NULL;
+            pool->shm_handle = NULL;
+            return INA_ERROR(INA_ES_FILE|INA_ERR_INVALID);
+        }
+        pool->pos = (size_t)hdr->pos;
+        pool->end = (size_t)hdr->end;
+        pool->hwm = pool->pos;
+        pool->lwm = pool->end;
+        return INA_SUCCESS;
+    }
+
+    static ina_rc_t
+    __ina_file_sync(ina_mempool_t *pool)
+    {
+        INA_ASSERT_NOT_NULL(pool);
+        INA_ASSERT_NOT_NULL(pool->m);
+
+        __INA_FILE_HDR(pool)->pos = pool->pos;
+        __INA_FILE_HDR(pool)->end = pool->end;
+        if (!FlushViewOfFile(pool->m, pool->size)) {
+            return INA_OS_ERROR(INA_ES_FILE|INA_ERR_FAILED);
+        }
+        return INA_SUCCESS;
+    }
+
+    static void
+    __ina_file_close(ina_mempool_t *pool)
+    {
+        INA_ASSERT_NOT_NULL(pool);
+
+        if (pool->m == NULL) {
+            return;
+        }
+        __INA_FILE_HDR(pool)->pos = pool->pos;
+        __INA_FILE_HDR(pool)->end = pool->end;
+        UnmapViewOfFile(pool->m);
+        CloseHandle(pool->shm_handle);
+        pool->m = NULL;
+        pool->shm_handle = NULL;
+        ina_str_free(pool->label);
+    }
+#endif
+
+#ifdef INA_OS_LINUX
+/* numaif.h is part of libnuma, use the plain syscalls */
+#define __INA_MPOL_PREFERRED (1)
+#define __INA_MPOL_BIND      (2)
+#define __INA_MPOL_MF_MOVE   (1<<1)
+#define __INA_NODE_WORDS     (INA_MEM_MAX_NODES/(8*sizeof(unsigned long)))
+#define __INA_MOVE_BATCH     (512)
+
+/*
+ * Bind the pages of a chunk to a node, INA_MEM_NODE_LOCAL is the node of the
+ * calling thread. Pages already in use are moved if move is set.
+ */
+static ina_rc_t
+__ina_chunk_bind(ina_mempool_t *pm, int node, int move)
+{
+    unsigned long mask[__INA_NODE_WORDS];
+    unsigned int cpu;
+    unsigned int cur;
+    size_t pagesize;
+    uintptr_t from;
+    uintptr_t to;
+    int mode;
+
+    mode = __INA_MPOL_BIND;
+    if (node == INA_MEM_NODE_LOCAL) {
+        /* first touch semantics, fall back to other nodes if full */
+        if (syscall(SYS_getcpu, &cpu, &cur, NULL) != 0) {
+            return INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
+        }
+        node = (int)cur;
+        mode = __INA_MPOL_PREFERRED;
+    }
+    ina_mem_get_pagesize(&pagesize);
+    from = ((uintptr_t)pm->m + pagesize - 1) & ~(uintptr_t)(pagesize - 1);
+    to = ((uintptr_t)pm->m + pm->size) & ~(uintptr_t)(pagesize - 1);
+    if (from >= to) {
+        return INA_SUCCESS;
+    }
+    ina_mem_set(mask, 0, sizeof(mask));
+    mask[(size_t)node/(8*sizeof(unsigned long))] = 1UL << ((size_t)node%(8*sizeof(unsigned long)));
+    if (syscall(SYS_mbind, from, to - from, mode, mask, INA_MEM_MAX_NODES + 1,
+                move ? __INA_MPOL_MF_MOVE : 0) != 0) {
+        return INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
+    }
+    return INA_SUCCESS;
+}
+
+/* Add the resident bytes of a chunk per node */
+static ina_rc_t
+__ina_chunk_nodes(ina_mempool_t *pm, size_t *usage, size_t nodes)
+{
+    void *pages[__INA_MOVE_BATCH];
+    int status[__INA_MOVE_BATCH];
+    size_t pagesize;
+    uintptr_t p;
+    uintptr_t to;
+    size_t n;
+    size_t i;
+
+    ina_mem_get_pagesize(&pagesize);
+    p = (uintptr_t)pm->m & ~(uintptr_t)(pagesize - 1);
+    to = (uintptr_t)pm->m + pm->size;
+    while (p < to) {
+        for (n = 0; n < __INA_MOVE_BATCH && p < to; ++n, p += pagesize) {
+            pages[n] = (void*)p;
+        }
+        /* without target nodes move_pages reports the node of each page */
+        if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) {
+            return INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
+        }
+        for (i = 0; i < n; ++i) {
+            if (status[i] >= 0 && (size_t)status[i] < nodes) {
+                usage[status[i]] += pagesize;
+            }
+        }
+    }
+    return INA_SUCCESS;
+}
+
+/*
+ * INA_MEM_SNAPSHOT chunks map a memory file. A snapshot maps the file a
+ * second time read-only and the chunk private, writes of the pool go to
+ * private copies while the file keeps the snapshot.
+ */
+#define __INA_MFD_CLOEXEC    (1)
+#define __INA_PAGEMAP_BATCH  ((size_t)512)
+#define __INA_PAGE_PRESENT   (1ULL << 63)
+#define __INA_PAGE_SWAPPED   (1ULL << 62)
+#define __INA_PAGE_SHARED    (1ULL << 61) /* file page or shared anonymous */
+
+static ina_rc_t
+__ina_snap_map(ina_mempool_t *pm)
+{
+    size_t pagesize;
+    int fd;
+
+    ina_mem_get_pagesize(&pagesize);
+    pm->size = (pm->size + pagesize - 1) & ~(pagesize - 1);
+    pm->end = pm->size;
+    pm->lwm = pm->size;
+
+#ifdef SYS_memfd_create
+    fd = (int)syscall(SYS_memfd_create, "ina_mempool", __INA_MFD_CLOEXEC);
+#else
+    fd = -1;
+    errno = ENOSYS;
+#endif
+    if (fd == -1) {
+        return INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+    }
+    if (ftruncate(fd, (off_t)pm->size) == -1) {
+        INA_OS_ERROR(INA_ES_MEMORY | INA_ERR_OUT_OF);
+        close(fd);
+        return ina_err_get_rc();
+    }
+    pm->m = (unsigned char*)mmap(NULL, pm->size, PROT_READ|PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+    if (pm->m == MAP_FAILED) {
+        pm->m = NULL;
+        INA_OS_ERROR(INA_ES_MEMORY | INA_ERR_OUT_OF);
+        close(fd);
+        return ina_err_get_rc();
+    }
+    pm->shm_handle = fd;
+    return INA_SUCCESS;
+}
+
+static ina_rc_t
+__ina_snap_take(ina_mempool_t *pm, const unsigned char **view)
+{
+    unsigned char *v;
+
+    if (pm->cow) {
+        INA_RETURN_IF_FAILED(__ina_snap_restore(pm));
+    }
+    v = (unsigned char*)mmap(NULL, pm->size, PROT_READ, MAP_SHARED,
+                             pm->shm_handle, 0);
+    if (v == MAP_FAILED) {
+        return INA_OS_ERROR(INA_ES_MEMORY | INA_ERR_OUT_OF);
+    }
+    if (mmap(pm->m, pm->size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+             pm->shm_handle, 0) == MAP_FAILED) {
+        INA_OS_ERROR(INA_ES_MEMORY | INA_ERR_OUT_OF);
+        munmap(v, pm->size);
+        return ina_err_get_rc();
+    }
+    pm->cow = 1;
+    *view = v;
+    return INA_SUCCESS;
+}
+
+/* Write pages of a private chunk to its file */
+static ina_rc_t
+__ina_snap_write(ina_mempool_t *pm, size_t from, size_t to)
+{
+    ssize_t n;
+
+    while (from < to) {
+        n = pwrite(pm->shm_handle, pm->m + from, to - from, (off_t)from);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return INA_OS_ERROR(INA_ES_OPERATION | INA_ERR_FAILED);
+        }
+        from += (size_t)n;
+    }
+    return INA_SUCCESS;
+}
+
+/* Write back the pages copied since the snapshot and share the file again */
+static ina_rc_t
+__ina_snap_restore(ina_mempool_t *pm)
+{
+    uint64_t map[__INA_PAGEMAP_BATCH];
+    size_t pagesize;
+    size_t npages;
+    size_t first;
+    size_t i;
+    size_t j;
+    size_t n;
+    int dirty;
+    int fd;
+
+    ina_mem_get_pagesize(&pagesize);
+    npages = pm->size/pagesize;
+    first = npages;
+
+    /* without the page map every page is written */
+    fd = open("/proc/self/pagemap", O_RDONLY);
+    for (i = 0; i < npages; i += n) {
+        n = INA_MIN(npages - i, __INA_PAGEMAP_BATCH);
+        if (fd == -1 ||
+            pread(fd, map, n*sizeof(uint64_t),
+                  (off_t)(((uintptr_t)pm->m/pagesize + i)*sizeof(uint64_t))) !=
+            (ssize_t)(n*sizeof(uint64_t))) {
+            for (j = 0; j < n; ++j) {
+                map[j] = __INA_PAGE_PRESENT;
+            }
+        }
+        for (j = 0; j < n; ++j) {
+            dirty = (map[j]&(__INA_PAGE_PRESENT|__INA_PAGE_SWAPPED)) &&
+                    !(map[j]&__INA_PAGE_SHARED);
+            if (dirty && first == npages) {
+                first = i + j;
+            } else if (!dirty && first != npages) {
+                if (INA_FAILED(__ina_snap_write(pm, first*pagesize, (i + j)*pagesize))) {
+                    goto fail;
+                }
+                first = npages;
+            }
+        }
+    }
+    if (first != npages &&
+        INA_FAILED(__ina_snap_write(pm, first*pagesize, npages*pagesize))) {
+        goto fail;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (mmap(pm->m, pm->size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+             pm->shm_handle, 0) == MAP_FAILED) {
+        return INA_OS_ERROR(INA_ES_MEMORY | INA_ERR_OUT_OF);
+    }
+    pm->cow = 0;
+    return INA_SUCCESS;
+
+fail:
+    if (fd != -1) {
+        close(fd);
+    }
+    return ina_err_get_rc();
+}
+
+static void
+__ina_snap_unview(const unsigned char *view, size_t size)
+{
+    munmap((void*)view, size);
+}
+#else
+static ina_rc_t
+__ina_chunk_bind(ina_mempool_t *pm, int node, int move)
+{
+    INA_UNUSED(pm);
+    INA_UNUSED(node);
+    INA_UNUSED(move);
+    return INA_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+}
+
+static ina_rc_t
+__ina_chunk_nodes(ina_mempool_t *pm, size_t *usage, size_t nodes)
+{
+    INA_UNUSED(pm);
+    INA_UNUSED(usage);
+    INA_UNUSED(nodes);
+    return INA_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+}
+
+static ina_rc_t
+__ina_snap_map(ina_mempool_t *pm)
+{
+    INA_UNUSED(pm);
+    return INA_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+}
+
+static ina_rc_t
+__ina_snap_take(ina_mempool_t *pm, const unsigned char **view)
+{
+    INA_UNUSED(pm);
+    INA_UNUSED(view);
+    return INA_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+}
+
+static ina_rc_t
+__ina_snap_restore(ina_mempool_t *pm)
+{
+    INA_UNUSED(pm);
+    return INA_ERROR(INA_ES_OPERATION | INA_ERR_NOT_SUPPORTED);
+}
+
+static void
+__ina_snap_unview(const unsigned char *view, size_t size)
+{
+    INA_UNUSED(view);
+    INA_UNUSED(size);
+}
 #endif
@@ -0,0 +1,451 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#define INA_MEM_PROFILE_IMPL
+#include <libinac-ce/lib.h>
+#include "config.h"
+
+#ifndef INA_OS_WIN32
+#include <pthread.h>
+#endif
+
+/*
+ * Every thread records into its own open addressing table keyed by the call
+ * site string, so recording needs neither locks nor atomics. Tables start
+ * small and double up to __INA_PROF_SLOTS call sites. They are linked into a
+ * global list once, the table of an exited thread is taken over by the next
+ * thread that starts recording. The lock of a table is held while its slots
+ * are replaced or read by another thread.
+ */
+#define __INA_PROF_SLOTS (1024)
+#define __INA_PROF_MIN_SLOTS (16)
+#define __INA_PROF_HASH(at) ((size_t)(((uintptr_t)(at) >> 3) * 0x9E3779B97F4A7C15ULL))
+
+typedef struct __ina_prof_table_s {
+    struct __ina_prof_table_s *next;
+    volatile int64_t owned;        /* a thread records into the table */
+    volatile int64_t lock;
+    size_t nslots;
+    size_t used;
+    ina_mem_profile_entry_t overflow;
+    ina_mem_profile_entry_t *slots;
+} __ina_prof_table_t;
+
+static volatile int64_t __tables = 0;
+static INA_TLS(__ina_prof_table_t*) __table = NULL;
+
+#ifdef INA_OS_WIN32
+static volatile int64_t __table_key_once = 0;
+static DWORD __table_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_once_t __table_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __table_key;
+#endif
+
+INA_INLINE void __ina_prof_lock(__ina_prof_table_t *t)
+{
+    while (INA_ATOMIC_SWAP(&t->lock, 0, 1) != 0) {
+    }
+}
+
+INA_INLINE void __ina_prof_unlock(__ina_prof_table_t *t)
+{
+    INA_ATOMIC_SWAP(&t->lock, 1, 0);
+}
+
+/* Hand the table of an exiting thread over to the next one */
+#ifdef INA_OS_WIN32
+static void WINAPI __ina_prof_thread_exit(void *arg)
+#else
+static void __ina_prof_thread_exit(void *arg)
+#endif
+{
+    __ina_prof_table_t *t = (__ina_prof_table_t*)arg;
+
+    if (t != NULL) {
+        __table = NULL;
+        INA_ATOMIC_SWAP(&t->owned, 1, 0);
+    }
+}
+
+#ifndef INA_OS_WIN32
+static void __ina_prof_key_create(void)
+{
+    pthread_key_create(&__table_key, __ina_prof_thread_exit);
+}
+#endif
+
+/* Make sure the table of the calling thread is handed over on exit */
+static void __ina_prof_hook_thread(__ina_prof_table_t *t)
+{
+#ifdef INA_OS_WIN32
+    if (__table_key_once != 2) {
+        if (INA_ATOMIC_SWAP(&__table_key_once, 0, 1) == 0) {
+            __table_key = FlsAlloc(__ina_prof_thread_exit);
+            __table_key_once = 2;
+        }
+        while (__table_key_once != 2) {
+        }
+    }
+    if (__table_key != FLS_OUT_OF_INDEXES) {
+        FlsSetValue(__table_key, t);
+    }
+#else
+    pthread_once(&__table_key_once, __ina_prof_key_create);
+    pthread_setspecific(__table_key, t);
+#endif
+}
+
+static __ina_prof_table_t *__ina_prof_table(void)
+{
+    __ina_prof_table_t *t;
+    int64_t head;
+
+    /* take over the table of an exited thread */
+    for (t = (__ina_prof_table_t*)(intptr_t)__tables; t != NULL; t = t->next) {
+        if (t->owned == 0 && INA_ATOMIC_SWAP(&t->owned, 0, 1) == 0) {
+            break;
+        }
+    }
+    if (t == NULL) {
+        t = (__ina_prof_table_t*)INA_MEM_CALLOC(1, sizeof(__ina_prof_table_t));
+        if (t == NULL) {
+            return NULL;
+        }
+        t->slots = (ina_mem_profile_entry_t*)INA_MEM_CALLOC(__INA_PROF_MIN_SLOTS,
+                sizeof(ina_mem_profile_entry_t));
+        if (t->slots == NULL) {
+            INA_MEM_FREE(t);
+            return NULL;
+        }
+        t->nslots = __INA_PROF_MIN_SLOTS;
+        t->owned = 1;
+        t->overflow.at = "(other)";
+        do {
+            head = __tables;
+            t->next = (__ina_prof_table_t*)(intptr_t)head;
+        } while (INA_ATOMIC_SWAP(&__tables, head, (int64_t)(intptr_t)t) != head);
+    }
+    __ina_prof_hook_thread(t);
+    __table = t;
+    return t;
+}
+
+/* Double the slots of a table, returns 0 if no memory is left */
+static int __ina_prof_grow(__ina_prof_table_t *t)
+{
+    ina_mem_profile_entry_t *slots;
+    ina_mem_profile_entry_t *old;
+    size_t nslots = 2*t->nslots;
+    size_t i;
+    size_t j;
+
+    slots = (ina_mem_profile_entry_t*)INA_MEM_CALLOC(nslots,
+            sizeof(ina_mem_profile_entry_t));
+    if (slots == NULL) {
+        return 0;
+    }
+    __ina_prof_lock(t);
+    for (i = 0; i < t->nslots; ++i) {
+        if (t->slots[i].at == NULL) {
+            continue;
+        }
+        j = __INA_PROF_HASH(t->slots[i].at) & (nslots - 1);
+        while (slots[j].at != NULL) {
+            j = (j + 1) & (nslots - 1);
+        }
+        slots[j] = t->slots[i];
+    }
+    old = t->slots;
+    t->slots = slots;
+    t->nslots = nslots;
+    __ina_prof_unlock(t);
+    INA_MEM_FREE(old);
+    return 1;
+}
+
+/* Entry of a call site, the overflow entry once the table is full */
+static ina_mem_profile_entry_t *__ina_prof_entry(__ina_prof_table_t *t,
+                                                 const char *at)
+{
+    ina_mem_profile_entry_t *s;
+    size_t mask;
+    size_t h;
+    size_t i;
+    int found;
+
+    for (;;) {
+        mask = t->nslots - 1;
+        h = __INA_PROF_HASH(at) & mask;
+        s = NULL;
+        for (i = 0; i <= mask / 4; ++i) {
+            s = &t->slots[(h + i) & mask];
+            if (s->at == at) {
+                return s;
+            }
+            if (s->at == NULL) {
+                break;
+            }
+        }
+        found = i <= mask / 4;
+        /* keep the table at most half full */
+        if (found && 2*(t->used + 1) <= t->nslots) {
+            break;
+        }
+        if (t->nslots >= __INA_PROF_SLOTS || !__ina_prof_grow(t)) {
+            if (!found) {
+                return &t->overflow;
+            }
+            break;
+        }
+    }
+    s->at = at;
+    ++t->used;
+    return s;
+}
+
+INA_INLINE size_t __ina_prof_class(size_t size)
+{
+    size_t l = 0;
+
+#if defined(__GNUC__)
+    if (size > 1) {
+        l = (sizeof(unsigned long long)*8) - (size_t)__builtin_clzll((unsigned long long)size - 1);
+    }
+#else
+    while (((size_t)1 << l) < size) {
+        ++l;
+    }
+#endif
+    return l < INA_MEM_PROFILE_HIST ? l : INA_MEM_PROFILE_HIST - 1;
+}
+
+static void __ina_prof_record(const char *at, size_t size, int is_free)
+{
+    __ina_prof_table_t *t = __table;
+    ina_mem_profile_entry_t *e;
+
+    if (INA_UNLIKELY(t == NULL) && (t = __ina_prof_table()) == NULL) {
+        return;
+    }
+    e = __ina_prof_entry(t, at);
+    if (is_free) {
+        ++e->frees;
+        return;
+    }
+    ++e->calls;
+    e->bytes += size;
+    ++e->hist[__ina_prof_class(size)];
+}
+
+static int __ina_prof_cmp_at(const void *a, const void *b)
+{
+    const ina_mem_profile_entry_t *l = (const ina_mem_profile_entry_t*)a;
+    const ina_mem_profile_entry_t *r = (const ina_mem_profile_entry_t*)b;
+    return strcmp(l->at, r->at);
+}
+
+static int __ina_prof_cmp_bytes(const void *a, const void *b)
+{
+    const ina_mem_profile_entry_t *l = (const ina_mem_profile_entry_t*)a;
+    const ina_mem_profile_entry_t *r = (const ina_mem_profile_entry_t*)b;
+    if (l->bytes != r->bytes) {
+        return l->bytes < r->bytes ? 1 : -1;
+    }
+    return l->calls < r->calls ? 1 : (l->calls > r->calls ? -1 : 0);
+}
+
+INA_API(ina_rc_t) ina_mem_profile_report(ina_mem_profile_entry_t **entries,
+                                         size_t *count)
+{
+    __ina_prof_table_t *head;
+    __ina_prof_table_t *t;
+    ina_mem_profile_entry_t *e;
+    size_t n;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    INA_VERIFY_NOT_NULL(entries);
+    INA_VERIFY_NOT_NULL(count);
+
+    /* tables added meanwhile are not reported */
+    head = (__ina_prof_table_t*)(intptr_t)__tables;
+    n = 0;
+    for (t = head; t != NULL; t = t->next) {
+        n += __INA_PROF_SLOTS + 1;
+    }
+    *entries = NULL;
+    *count = 0;
+    if (n == 0) {
+        return INA_SUCCESS;
+    }
+    e = (ina_mem_profile_entry_t*)ina_mem_alloc(n*sizeof(ina_mem_profile_entry_t));
+    INA_RETURN_IF_NULL(e);
+
+    n = 0;
+    for (t = head; t != NULL; t = t->next) {
+        __ina_prof_lock(t);
+        for (i = 0; i < t->nslots; ++i) {
+            if (t->slots[i].at != NULL) {
+                e[n++] = t->slots[i];
+            }
+        }
+        __ina_prof_unlock(t);
+        if (t->overflow.calls || t->overflow.frees) {
+            e[n++] = t->overflow;
+        }
+    }
+
+    /* merge call sites recorded by several threads */
+    qsort(e, n, sizeof(ina_mem_profile_entry_t), __ina_prof_cmp_at);
+    for (i = 0, j = 0; i < n; ++j) {
+        e[j] = e[i];
+        for (++i; i < n && strcmp(e[i].at, e[j].at) == 0; ++i) {
+            e[j].calls += e[i].calls;
+            e[j].frees += e[i].frees;
+            e[j].bytes += e[i].bytes;
+            for (k = 0; k < INA_MEM_PROFILE_HIST; ++k) {
+                e[j].hist[k] += e[i].hist[k];
+            }
+        }
+    }
+    qsort(e, j, sizeof(ina_mem_profile_entry_t), __ina_prof_cmp_bytes);
+    *entries = e;
+    *count = j;
+    return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_mem_profile_dump(FILE *fp)
+{
+    ina_mem_profile_entry_t *e;
+    size_t n;
+    size_t i;
+    size_t k;
+
+    INA_VERIFY_NOT_NULL(fp);
+    INA_RETURN_IF_FAILED(ina_mem_profile_report(&e, &n));
+
+    fprintf(fp, "%16s %12s %12s  %s\n", "bytes", "calls", "frees", "call site");
+    for (i = 0; i < n; ++i) {
+        fprintf(fp, "%16" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %s\n",
+                e[i].bytes, e[i].calls, e[i].frees, e[i].at);
+        for (k = 0; k < INA_MEM_PROFILE_HIST; ++k) {
+            if (e[i].hist[k] != 0) {
+                fprintf(fp, "%16s <= %-10" PRIu64 " %12" PRIu64 "\n", "",
+                        (uint64_t)1 << k, e[i].hist[k]);
+            }
+        }
+    }
+    if (e != NULL) {
+        ina_mem_free(e);
+    }
+    return INA_SUCCESS;
+}
+
+INA_API(void) ina_mem_profile_reset(void)
+{
+    __ina_prof_table_t *t;
+    size_t i;
+
+    for (t = (__ina_prof_table_t*)(intptr_t)__tables; t != NULL; t = t->next) {
+        __ina_prof_lock(t);
+        for (i = 0; i < t->nslots; ++i) {
+            t->slots[i].calls = 0;
+            t->slots[i].frees = 0;
+            t->slots[i].bytes = 0;
+            ina_mem_set(t->slots[i].hist, 0, sizeof(t->slots[i].hist));
+        }
+        __ina_prof_unlock(t);
+        t->overflow.calls = 0;
+        t->overflow.frees = 0;
+        t->overflow.bytes = 0;
+        ina_mem_set(t->overflow.hist, 0, sizeof(t->overflow.hist));
+    }
+}
+
+INA_API(void*) ina_mem_profile_alloc(const char *at, size_t size)
+{
+    __ina_prof_record(at, size, 0);
+    return ina_mem_alloc(size);
+}
+
+INA_API(void*) ina_mem_profile_calloc(const char *at, size_t size)
+{
+    __ina_prof_record(at, size, 0);
+    return ina_mem_calloc(size);
+}
+
+INA_API(void*) ina_mem_profile_alloc_aligned(const char *at, size_t alignment,
+                                             size_t size)
+{
+    __ina_prof_record(at, size, 0);
+    return ina_mem_alloc_aligned(alignment, size);
+}
+
+INA_API(void*) ina_mem_profile_realloc(const char *at, void *ptr, size_t nb)
+{
+    __ina_prof_record(at, nb, nb == 0);
+    return ina_mem_realloc(ptr, nb);
+}
+
+INA_API(void*) ina_mem_profile_realloc_aligned(const char *at, void *ptr,
+                                               size_t alignment, size_t nb)
+{
+    __ina_prof_record(at, nb, nb == 0);
+    return ina_mem_realloc_aligned(ptr, alignment, nb);
+}
+
+INA_API(void) ina_mem_profile_free(const char *at, void *ptr)
+{
+    __ina_prof_record(at, 0, 1);
+    ina_mem_free(ptr);
+}
+
+INA_API(void) ina_mem_profile_free_aligned(const char *at, void *ptr)
+{
+    __ina_prof_record(at, 0, 1);
+    ina_mem_free_aligned(ptr);
+}
+
+INA_API(void*) ina_mem_profile_dalloc(const char *at, ina_mempool_t *pool,
+                                      size_t size)
+{
+    __ina_prof_record(at, size, 0);
+    return ina_mempool_dalloc(pool, size);
+}
+
+INA_API(void*) ina_mem_profile_dalloc_aligned(const char *at,
+                                              ina_mempool_t *pool, size_t size,
+                                              size_t alignment)
+{
+    __ina_prof_record(at, size, 0);
+    return ina_mempool_dalloc_aligned(pool, size, alignment);
+}
+
+INA_API(void*) ina_mem_profile_nalloc(const char *at, ina_mempool_t *pool,
+                                      size_t size)
+{
+    __ina_prof_record(at, size, 0);
+    return ina_mempool_nalloc(pool, size);
+}
+
+INA_API(void*) ina_mem_profile_ralloc(const char *at, ina_mempool_t *pool,
+                                      void *old, size_t old_size,
+                                      size_t new_size)
+{
+    __ina_prof_record(at, new_size, 0);
+    return ina_mempool_ralloc(pool, old, old_size, new_size);
+}
+
+INA_API(void) ina_mem_profile_dfree(const char *at, ina_mempool_t *pool,
+                                    void *ptr, size_t size)
+{
+    __ina_prof_record(at, size, 1);
+    ina_mempool_dfree(pool, ptr, size);
+}
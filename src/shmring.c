@@ -0,0 +1,406 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include <libinac-ce/lib.h>
+#include "config.h"
+
+#ifdef INA_OS_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#ifndef INA_OS_WIN32
+#include <time.h>
+#endif
+
+#define __INA_SHMRING_MAGIC (0x474E495252414E49ULL) /* "INARRING" */
+#define __INA_CL INA_MEM_CACHELINE_SIZE
+
+/*
+ * The ring is addressed relative to itself only, so it works at any address
+ * it is mapped at. Producer and consumer indices are on separate cache lines,
+ * the SPSC ring keeps a cached copy of the other side's index next to its own.
+ * MPMC slots carry a sequence number (D. Vyukov's bounded queue).
+ */
+struct ina_shmring_s {
+    uint64_t magic;
+    uint32_t cf;
+    uint32_t item_size;
+    uint64_t mask;
+    uint64_t stride;
+    unsigned char pad0[__INA_CL - 32];
+    volatile int64_t tail;         /* next item to push */
+    int64_t head_cache;            /* SPSC: head as last seen by the producer */
+    unsigned char pad1[__INA_CL - 16];
+    volatile int64_t head;         /* next item to pop */
+    int64_t tail_cache;            /* SPSC: tail as last seen by the consumer */
+    unsigned char pad2[__INA_CL - 16];
+    volatile int64_t wait_items;   /* consumers waiting for items */
+    volatile int64_t wait_room;    /* producers waiting for room */
+    volatile int32_t items_ev;     /* futex, bumped after push if waited for */
+    volatile int32_t room_ev;      /* futex, bumped after pop if waited for */
+    unsigned char pad3[__INA_CL - 24];
+};
+
+#define __INA_SHMRING_DATA(ring) ((unsigned char*)(ring) + sizeof(ina_shmring_t))
+#define __INA_SHMRING_SLOT(ring, i) \
+    (__INA_SHMRING_DATA(ring) + ((uint64_t)(i) & (ring)->mask) * (ring)->stride)
+#define __INA_SHMRING_SEQ(slot) ((volatile int64_t*)(slot))
+
+#ifdef INA_OS_WIN32
+static int64_t __ina_shmring_now(void)
+{
+    return (int64_t)GetTickCount64();
+}
+#else
+static int64_t __ina_shmring_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+#ifdef INA_OS_LINUX
+/* Process shared futex, works across mappings of the same memory */
+static void __ina_shmring_sleep(volatile int32_t *ev, int32_t val, int64_t ms)
+{
+    struct timespec ts;
+
+    if (ms < 0) {
+        syscall(SYS_futex, ev, FUTEX_WAIT, val, NULL, NULL, 0);
+        return;
+    }
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    syscall(SYS_futex, ev, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void __ina_shmring_signal(volatile int64_t *waiters, volatile int32_t *ev)
+{
+    /* full barrier, the index store must be visible before waiters is read */
+    if (INA_ATOMIC_ADD(waiters, 0) == 0) {
+        return;
+    }
+    __sync_fetch_and_add(ev, 1);
+    syscall(SYS_futex, ev, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+#else
+/* No process shared wait primitive, poll */
+static void __ina_shmring_sleep(volatile int32_t *ev, int32_t val, int64_t ms)
+{
+    INA_UNUSED(ev);
+    INA_UNUSED(val);
+    INA_UNUSED(ms);
+#ifdef INA_OS_WIN32
+    Sleep(1);
+#else
+    {
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 100000;
+        nanosleep(&ts, NULL);
+    }
+#endif
+}
+
+static void __ina_shmring_signal(volatile int64_t *waiters, volatile int32_t *ev)
+{
+    INA_UNUSED(waiters);
+    INA_UNUSED(ev);
+}
+#endif
+
+INA_API(ina_rc_t) ina_shmring_new(ina_mempool_t *pool, size_t item_size,
+                                  size_t capacity, uint32_t cf,
+                                  ina_shmring_t **ring)
+{
+    ina_shmring_t *r;
+    uint64_t cap;
+    size_t stride;
+    uint64_t i;
+
+    INA_VERIFY_NOT_NULL(pool);
+    INA_VERIFY_NOT_NULL(ring);
+    INA_VERIFY(item_size > 0 && item_size <= UINT32_MAX);
+    INA_VERIFY(capacity > 0 && capacity <= ((size_t)1 << 48));
+
+    for (cap = 2; cap < capacity; cap <<= 1) {
+    }
+    if (cf&INA_SHMRING_MPMC) {
+        stride = INA_MEM_ALIGN_TO(sizeof(int64_t) + item_size, sizeof(int64_t));
+    } else {
+        stride = item_size;
+    }
+    if (stride > (SIZE_MAX - sizeof(ina_shmring_t)) / cap) {
+        return INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+    }
+
+    r = (ina_shmring_t*)ina_mempool_dalloc_aligned(pool,
+        sizeof(ina_shmring_t) + (size_t)cap * stride, INA_MEM_CACHELINE_SIZE);
+    INA_RETURN_IF_NULL(r);
+    ina_mem_set(r, 0, sizeof(ina_shmring_t));
+    r->cf = cf;
+    r->item_size = (uint32_t)item_size;
+    r->mask = cap - 1;
+    r->stride = stride;
+    if (cf&INA_SHMRING_MPMC) {
+        for (i = 0; i < cap; ++i) {
+            *__INA_SHMRING_SEQ(__INA_SHMRING_SLOT(r, i)) = (int64_t)i;
+        }
+    }
+    /* attached processes accept the ring once the magic is visible */
+    INA_ATOMIC_STORE((volatile int64_t*)&r->magic, (int64_t)__INA_SHMRING_MAGIC);
+    *ring = r;
+    return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_shmring_attach(ina_mempool_t *pool, size_t off,
+                                     ina_shmring_t **ring)
+{
+    ina_shmring_t *r;
+
+    INA_VERIFY_NOT_NULL(pool);
+    INA_VERIFY_NOT_NULL(ring);
+
+    r = (ina_shmring_t*)ina_mempool_off2ptr(pool, off);
+    if (r == NULL || ((uintptr_t)r & (INA_MEM_CACHELINE_SIZE - 1)) != 0 ||
+        (uint64_t)INA_ATOMIC_LOAD((volatile int64_t*)&r->magic) != __INA_SHMRING_MAGIC) {
+        return INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+    }
+    *ring = r;
+    return INA_SUCCESS;
+}
+
+/* Copy n items between the ring starting at index i and a flat array */
+static void __ina_shmring_copy(ina_shmring_t *ring, uint64_t i,
+                               unsigned char *items, size_t n, int to_ring)
+{
+    uint64_t cap = ring->mask + 1;
+    uint64_t first = INA_MIN(n, cap - (i & ring->mask));
+    unsigned char *slot = __INA_SHMRING_SLOT(ring, i);
+    size_t size = ring->item_size;
+
+    if (to_ring) {
+        ina_mem_cpy(slot, items, first * size);
+        ina_mem_cpy(__INA_SHMRING_DATA(ring), items + first * size, (n - first) * size);
+    } else {
+        ina_mem_cpy(items, slot, first * size);
+        ina_mem_cpy(items + first * size, __INA_SHMRING_DATA(ring), (n - first) * size);
+    }
+}
+
+static size_t __ina_shmring_spsc_push(ina_shmring_t *ring,
+                                      const unsigned char *items, size_t count)
+{
+    int64_t tail = ring->tail;
+    uint64_t cap = ring->mask + 1;
+    uint64_t room = cap - (uint64_t)(tail - ring->head_cache);
+    size_t n;
+
+    if (room < count) {
+        ring->head_cache = INA_ATOMIC_LOAD(&ring->head);
+        room = cap - (uint64_t)(tail - ring->head_cache);
+    }
+    n = (size_t)INA_MIN((uint64_t)count, room);
+    if (n == 0) {
+        return 0;
+    }
+    __ina_shmring_copy(ring, (uint64_t)tail, (unsigned char*)items, n, 1);
+    INA_ATOMIC_STORE(&ring->tail, tail + (int64_t)n);
+    return n;
+}
+
+static size_t __ina_shmring_spsc_pop(ina_shmring_t *ring,
+                                     unsigned char *items, size_t count)
+{
+    int64_t head = ring->head;
+    uint64_t avail = (uint64_t)(ring->tail_cache - head);
+    size_t n;
+
+    if (avail < count) {
+        ring->tail_cache = INA_ATOMIC_LOAD(&ring->tail);
+        avail = (uint64_t)(ring->tail_cache - head);
+    }
+    n = (size_t)INA_MIN((uint64_t)count, avail);
+    if (n == 0) {
+        return 0;
+    }
+    __ina_shmring_copy(ring, (uint64_t)head, items, n, 0);
+    INA_ATOMIC_STORE(&ring->head, head + (int64_t)n);
+    return n;
+}
+
+static size_t __ina_shmring_mpmc_push(ina_shmring_t *ring,
+                                      const unsigned char *items, size_t count)
+{
+    unsigned char *slot;
+    int64_t pos;
+    int64_t seq;
+    int64_t prev;
+    size_t n;
+
+    for (n = 0; n < count; ++n) {
+        pos = INA_ATOMIC_LOAD(&ring->tail);
+        for (;;) {
+            slot = __INA_SHMRING_SLOT(ring, pos);
+            seq = INA_ATOMIC_LOAD(__INA_SHMRING_SEQ(slot));
+            if (seq == pos) {
+                prev = INA_ATOMIC_SWAP(&ring->tail, pos, pos + 1);
+                if (prev == pos) {
+                    break;
+                }
+                pos = prev;
+            } else if (seq < pos) {
+                /* slot not yet consumed, full */
+                return n;
+            } else {
+                pos = INA_ATOMIC_LOAD(&ring->tail);
+            }
+        }
+        ina_mem_cpy(slot + sizeof(int64_t), items + n * ring->item_size,
+                    ring->item_size);
+        INA_ATOMIC_STORE(__INA_SHMRING_SEQ(slot), pos + 1);
+    }
+    return n;
+}
+
+static size_t __ina_shmring_mpmc_pop(ina_shmring_t *ring,
+                                     unsigned char *items, size_t count)
+{
+    unsigned char *slot;
+    int64_t pos;
+    int64_t seq;
+    int64_t prev;
+    size_t n;
+
+    for (n = 0; n < count; ++n) {
+        pos = INA_ATOMIC_LOAD(&ring->head);
+        for (;;) {
+            slot = __INA_SHMRING_SLOT(ring, pos);
+            seq = INA_ATOMIC_LOAD(__INA_SHMRING_SEQ(slot));
+            if (seq == pos + 1) {
+                prev = INA_ATOMIC_SWAP(&ring->head, pos, pos + 1);
+                if (prev == pos) {
+                    break;
+                }
+                pos = prev;
+            } else if (seq < pos + 1) {
+                /* slot not yet produced, empty */
+                return n;
+            } else {
+                pos = INA_ATOMIC_LOAD(&ring->head);
+            }
+        }
+        ina_mem_cpy(items + n * ring->item_size, slot + sizeof(int64_t),
+                    ring->item_size);
+        INA_ATOMIC_STORE(__INA_SHMRING_SEQ(slot), pos + (int64_t)ring->mask + 1);
+    }
+    return n;
+}
+
+INA_API(size_t) ina_shmring_push(ina_shmring_t *ring, const void *items,
+                                 size_t count)
+{
+    size_t n;
+
+    INA_ASSERT_NOT_NULL(ring);
+    INA_ASSERT(count == 0 || items != NULL);
+
+    if (ring->cf&INA_SHMRING_MPMC) {
+        n = __ina_shmring_mpmc_push(ring, (const unsigned char*)items, count);
+    } else {
+        n = __ina_shmring_spsc_push(ring, (const unsigned char*)items, count);
+    }
+    if (n > 0 && ring->cf&INA_SHMRING_BLOCKING) {
+        __ina_shmring_signal(&ring->wait_items, &ring->items_ev);
+    }
+    return n;
+}
+
+INA_API(size_t) ina_shmring_pop(ina_shmring_t *ring, void *items, size_t count)
+{
+    size_t n;
+
+    INA_ASSERT_NOT_NULL(ring);
+    INA_ASSERT(count == 0 || items != NULL);
+
+    if (ring->cf&INA_SHMRING_MPMC) {
+        n = __ina_shmring_mpmc_pop(ring, (unsigned char*)items, count);
+    } else {
+        n = __ina_shmring_spsc_pop(ring, (unsigned char*)items, count);
+    }
+    if (n > 0 && ring->cf&INA_SHMRING_BLOCKING) {
+        __ina_shmring_signal(&ring->wait_room, &ring->room_ev);
+    }
+    return n;
+}
+
+INA_API(size_t) ina_shmring_count(ina_shmring_t *ring)
+{
+    int64_t head;
+    int64_t tail;
+
+    INA_ASSERT_NOT_NULL(ring);
+
+    head = INA_ATOMIC_LOAD(&ring->head);
+    tail = INA_ATOMIC_LOAD(&ring->tail);
+    if (tail <= head) {
+        return 0;
+    }
+    return (size_t)INA_MIN((uint64_t)(tail - head), ring->mask + 1);
+}
+
+/* Wait for room (push) or items (!push) */
+static ina_rc_t __ina_shmring_wait(ina_shmring_t *ring, int push,
+                                   int64_t timeout)
+{
+    volatile int64_t *waiters = push ? &ring->wait_room : &ring->wait_items;
+    volatile int32_t *ev = push ? &ring->room_ev : &ring->items_ev;
+    int64_t deadline = 0;
+    int64_t left = -1;
+    int32_t val;
+
+    if (timeout >= 0) {
+        deadline = __ina_shmring_now() + timeout;
+    }
+    for (;;) {
+        if (push ? ina_shmring_count(ring) <= ring->mask : ina_shmring_count(ring) > 0) {
+            return INA_SUCCESS;
+        }
+        if (timeout >= 0) {
+            left = deadline - __ina_shmring_now();
+            if (left <= 0) {
+                return INA_ERROR(INA_ES_OPERATION | INA_ERR_TIMED_OUT);
+            }
+        }
+        val = *ev;
+        INA_ATOMIC_INC(waiters);
+        /* check again, a signal before the increment would be lost */
+        if (push ? ina_shmring_count(ring) <= ring->mask : ina_shmring_count(ring) > 0) {
+            INA_ATOMIC_DEC(waiters);
+            return INA_SUCCESS;
+        }
+        __ina_shmring_sleep(ev, val, left);
+        INA_ATOMIC_DEC(waiters);
+    }
+}
+
+INA_API(ina_rc_t) ina_shmring_wait_push(ina_shmring_t *ring, int64_t timeout)
+{
+    INA_VERIFY_NOT_NULL(ring);
+    INA_VERIFY(ring->cf&INA_SHMRING_BLOCKING);
+    return __ina_shmring_wait(ring, 1, timeout);
+}
+
+INA_API(ina_rc_t) ina_shmring_wait_pop(ina_shmring_t *ring, int64_t timeout)
+{
+    INA_VERIFY_NOT_NULL(ring);
+    INA_VERIFY(ring->cf&INA_SHMRING_BLOCKING);
+    return __ina_shmring_wait(ring, 0, timeout);
+}
@@ -0,0 +1,340 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include <libinac-ce/lib.h>
+#include "config.h"
+#include "simd.h"
+
+/* Below this size streaming stores do not pay off */
+#define __INA_NT_MIN (256)
+
+typedef void (*__ina_set_fn_t)(unsigned char *dest, int value, size_t nb);
+typedef void (*__ina_cpy_fn_t)(unsigned char *dest, const unsigned char *src,
+                               size_t nb);
+
+typedef const char *(*__ina_find_fn_t)(const char *s, size_t len,
+                                       const char *needle, size_t nlen);
+
+static volatile int __features = -1;
+static __ina_set_fn_t __set_nt = NULL;
+static __ina_cpy_fn_t __cpy_nt = NULL;
+static __ina_find_fn_t __find = NULL;
+
+int __ina_cpu_features(void)
+{
+    int f = 0;
+
+    if (INA_LIKELY(__features >= 0)) {
+        return __features;
+    }
+#if defined(__INA_SIMD_X86) && defined(INA_COMPILER_MSVC)
+    {
+        int r[4];
+        __cpuid(r, 1);
+        if (r[3] & (1 << 26)) {
+            f |= __INA_CPU_SSE2;
+        }
+        /* AVX state must be enabled by the OS (OSXSAVE, XCR0) */
+        if ((r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(r, 7, 0);
+            if (r[1] & (1 << 5)) {
+                f |= __INA_CPU_AVX2;
+            }
+        }
+    }
+#elif defined(__INA_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        f |= __INA_CPU_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        f |= __INA_CPU_AVX2;
+    }
+#endif
+    __features = f;
+    return f;
+}
+
+static void __ina_set_nt_generic(unsigned char *dest, int value, size_t nb)
+{
+    ina_mem_set(dest, value, nb);
+}
+
+static void __ina_cpy_nt_generic(unsigned char *dest, const unsigned char *src,
+                                 size_t nb)
+{
+    ina_mem_cpy(dest, src, nb);
+}
+
+#ifdef __INA_SIMD_X86
+/*
+ * The destination is aligned by a regular head store, the bulk is written
+ * with streaming stores that bypass the caches, the fence orders them before
+ * later stores.
+ */
+static void __ina_set_nt_sse2(unsigned char *dest, int value, size_t nb)
+{
+    __m128i v = _mm_set1_epi8((char)value);
+    size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+
+    ina_mem_set(dest, value, head);
+    dest += head;
+    nb -= head;
+    for (; nb >= 64; nb -= 64, dest += 64) {
+        _mm_stream_si128((__m128i*)dest, v);
+        _mm_stream_si128((__m128i*)(dest + 16), v);
+        _mm_stream_si128((__m128i*)(dest + 32), v);
+        _mm_stream_si128((__m128i*)(dest + 48), v);
+    }
+    _mm_sfence();
+    ina_mem_set(dest, value, nb);
+}
+
+static void __ina_cpy_nt_sse2(unsigned char *dest, const unsigned char *src,
+                              size_t nb)
+{
+    size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+    __m128i a, b, c, d;
+
+    ina_mem_cpy(dest, src, head);
+    dest += head;
+    src += head;
+    nb -= head;
+    for (; nb >= 64; nb -= 64, dest += 64, src += 64) {
+        a = _mm_loadu_si128((const __m128i*)src);
+        b = _mm_loadu_si128((const __m128i*)(src + 16));
+        c = _mm_loadu_si128((const __m128i*)(src + 32));
+        d = _mm_loadu_si128((const __m128i*)(src + 48));
+        _mm_stream_si128((__m128i*)dest, a);
+        _mm_stream_si128((__m128i*)(dest + 16), b);
+        _mm_stream_si128((__m128i*)(dest + 32), c);
+        _mm_stream_si128((__m128i*)(dest + 48), d);
+    }
+    _mm_sfence();
+    ina_mem_cpy(dest, src, nb);
+}
+
+__INA_TARGET_AVX2
+static void __ina_set_nt_avx2(unsigned char *dest, int value, size_t nb)
+{
+    __m256i v = _mm256_set1_epi8((char)value);
+    size_t head = (32 - ((uintptr_t)dest & 31)) & 31;
+
+    ina_mem_set(dest, value, head);
+    dest += head;
+    nb -= head;
+    for (; nb >= 128; nb -= 128, dest += 128) {
+        _mm256_stream_si256((__m256i*)dest, v);
+        _mm256_stream_si256((__m256i*)(dest + 32), v);
+        _mm256_stream_si256((__m256i*)(dest + 64), v);
+        _mm256_stream_si256((__m256i*)(dest + 96), v);
+    }
+    _mm_sfence();
+    ina_mem_set(dest, value, nb);
+}
+
+__INA_TARGET_AVX2
+static void __ina_cpy_nt_avx2(unsigned char *dest, const unsigned char *src,
+                              size_t nb)
+{
+    size_t head = (32 - ((uintptr_t)dest & 31)) & 31;
+    __m256i a, b, c, d;
+
+    ina_mem_cpy(dest, src, head);
+    dest += head;
+    src += head;
+    nb -= head;
+    for (; nb >= 128; nb -= 128, dest += 128, src += 128) {
+        a = _mm256_loadu_si256((const __m256i*)src);
+        b = _mm256_loadu_si256((const __m256i*)(src + 32));
+        c = _mm256_loadu_si256((const __m256i*)(src + 64));
+        d = _mm256_loadu_si256((const __m256i*)(src + 96));
+        _mm256_stream_si256((__m256i*)dest, a);
+        _mm256_stream_si256((__m256i*)(dest + 32), b);
+        _mm256_stream_si256((__m256i*)(dest + 64), c);
+        _mm256_stream_si256((__m256i*)(dest + 96), d);
+    }
+    _mm_sfence();
+    ina_mem_cpy(dest, src, nb);
+}
+#endif
+
+static void __ina_nt_select(void)
+{
+    int f = __ina_cpu_features();
+
+    __cpy_nt = __ina_cpy_nt_generic;
+    __set_nt = __ina_set_nt_generic;
+#ifdef __INA_SIMD_X86
+    if (f&__INA_CPU_AVX2) {
+        __cpy_nt = __ina_cpy_nt_avx2;
+        __set_nt = __ina_set_nt_avx2;
+    } else if (f&__INA_CPU_SSE2) {
+        __cpy_nt = __ina_cpy_nt_sse2;
+        __set_nt = __ina_set_nt_sse2;
+    }
+#else
+    INA_UNUSED(f);
+#endif
+}
+
+INA_API(void*) ina_mem_set_nt(void *dest, int value, size_t nb)
+{
+    INA_ASSERT_NOT_NULL(dest);
+
+    if (nb < __INA_NT_MIN) {
+        return ina_mem_set(dest, value, nb);
+    }
+    if (INA_UNLIKELY(__set_nt == NULL)) {
+        __ina_nt_select();
+    }
+    __set_nt((unsigned char*)dest, value, nb);
+    return dest;
+}
+
+INA_API(void*) ina_mem_cpy_nt(void *dest, const void *src, size_t nb)
+{
+    INA_ASSERT_NOT_NULL(dest);
+    INA_ASSERT_NOT_NULL(src);
+
+    if (nb < __INA_NT_MIN) {
+        return ina_mem_cpy(dest, src, nb);
+    }
+    if (INA_UNLIKELY(__cpy_nt == NULL)) {
+        __ina_nt_select();
+    }
+    __cpy_nt((unsigned char*)dest, (const unsigned char*)src, nb);
+    return dest;
+}
+
+/* Below this size the vector kernels do not pay off */
+#define __INA_FIND_MIN (32)
+
+INA_INLINE size_t __ina_ctz32(uint32_t n)
+{
+#if defined(INA_COMPILER_MSVC)
+    unsigned long l;
+    _BitScanForward(&l, n);
+    return (size_t)l;
+#else
+    return (size_t)__builtin_ctz(n);
+#endif
+}
+
+static const char *__ina_find_generic(const char *s, size_t len,
+                                      const char *needle, size_t nlen)
+{
+    const char *end;
+    const char *p;
+
+    if (nlen > len) {
+        return NULL;
+    }
+    /* a match starts in front of end */
+    end = s + len - nlen + 1;
+    while (s < end && (p = (const char*)memchr(s, needle[0], (size_t)(end - s))) != NULL) {
+        if (nlen == 1 || ina_mem_cmp(p + 1, needle + 1, nlen - 1) == 0) {
+            return p;
+        }
+        s = p + 1;
+    }
+    return NULL;
+}
+
+#ifdef __INA_SIMD_X86
+/*
+ * Candidates are positions where the first and the last byte of the needle
+ * match, one compare of each per vector. Only candidates are compared in
+ * full, single byte needles have no false positives.
+ */
+static const char *__ina_find_sse2(const char *s, size_t len,
+                                   const char *needle, size_t nlen)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    __m128i a;
+    __m128i b;
+    uint32_t mask;
+    size_t i;
+    size_t k;
+
+    for (i = 0; i + nlen - 1 + 16 <= len; i += 16) {
+        a = _mm_loadu_si128((const __m128i*)(s + i));
+        b = _mm_loadu_si128((const __m128i*)(s + i + nlen - 1));
+        mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                         _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            k = __ina_ctz32(mask);
+            if (nlen <= 2 || ina_mem_cmp(s + i + k + 1, needle + 1, nlen - 2) == 0) {
+                return s + i + k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return __ina_find_generic(s + i, len - i, needle, nlen);
+}
+
+__INA_TARGET_AVX2
+static const char *__ina_find_avx2(const char *s, size_t len,
+                                   const char *needle, size_t nlen)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+    __m256i a;
+    __m256i b;
+    uint32_t mask;
+    size_t i;
+    size_t k;
+
+    for (i = 0; i + nlen - 1 + 32 <= len; i += 32) {
+        a = _mm256_loadu_si256((const __m256i*)(s + i));
+        b = _mm256_loadu_si256((const __m256i*)(s + i + nlen - 1));
+        mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                               _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            k = __ina_ctz32(mask);
+            if (nlen <= 2 || ina_mem_cmp(s + i + k + 1, needle + 1, nlen - 2) == 0) {
+                return s + i + k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return __ina_find_generic(s + i, len - i, needle, nlen);
+}
+#endif
+
+static void __ina_find_select(void)
+{
+    int f = __ina_cpu_features();
+
+    __find = __ina_find_generic;
+#ifdef __INA_SIMD_X86
+    if (f&__INA_CPU_AVX2) {
+        __find = __ina_find_avx2;
+    } else if (f&__INA_CPU_SSE2) {
+        __find = __ina_find_sse2;
+    }
+#else
+    INA_UNUSED(f);
+#endif
+}
+
+const char *__ina_mem_find(const char *s, size_t len, const char *needle,
+                           size_t nlen)
+{
+    if (nlen == 0 || nlen > len) {
+        return NULL;
+    }
+    if (len < __INA_FIND_MIN) {
+        return __ina_find_generic(s, len, needle, nlen);
+    }
+    if (INA_UNLIKELY(__find == NULL)) {
+        __ina_find_select();
+    }
+    return __find(s, len, needle, nlen);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#ifndef _LIBINAC_SIMD_H_
+#define _LIBINAC_SIMD_H_
+
+/*
+ * Internal SIMD support. Kernels for newer instruction sets are compiled
+ * per function and selected at runtime by __ina_cpu_features().
+ */
+
+#if defined(INA_CPU_X86) && (defined(INA_COMPILER_GCC) || defined(INA_COMPILER_MSVC))
+#define __INA_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(INA_COMPILER_GCC)
+#define __INA_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define __INA_TARGET_AVX2
+#endif
+
+/* CPU features */
+#define __INA_CPU_SSE2  (1)
+#define __INA_CPU_AVX2  (2)
+
+/* Features of the CPU, detected on first use */
+int __ina_cpu_features(void);
+
+/*
+ * Find the first occurrence of needle in the len bytes at s, NULL if not
+ * found or nlen is 0
+ */
+const char *__ina_mem_find(const char *s, size_t len, const char *needle,
+                           size_t nlen);
+
+#endif
@@ -0,0 +1,534 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include <libinac-ce/lib.h>
+#include "config.h"
+
+#ifndef INA_OS_WIN32
+#include <pthread.h>
+#endif
+
+/*
+ * Pages are aligned to their size, the page of an object is found by
+ * masking its address. All pages of a slab have the same size. Free objects
+ * are linked through their first word.
+ */
+typedef struct __ina_slab_page_s {
+    ina_slab_t *slab;
+    struct __ina_slab_page_s *next;
+    struct __ina_slab_page_s *prev;
+    void *free;           /* free list of the page */
+    size_t bump;          /* offset of objects never handed out */
+    size_t inuse;
+} __ina_slab_page_t;
+
+#define __INA_SLAB_PAGE(slab, ptr) \
+    ((__ina_slab_page_t*)((uintptr_t)(ptr) & ~((uintptr_t)(slab)->page_size - 1)))
+#define __INA_SLAB_FIRST INA_MEM_ALIGN(sizeof(__ina_slab_page_t))
+
+struct ina_slab_s {
+    uint32_t cf;
+    size_t obj_size;
+    size_t page_size;
+    size_t nobj;                   /* objects per page */
+    __ina_slab_page_t *partial;    /* pages with free objects */
+    __ina_slab_page_t *full;
+    __ina_slab_page_t *empty;      /* spare page */
+    size_t npages;
+    size_t inuse;
+    volatile int64_t lock;
+    int64_t epoch;
+    struct ina_slab_s *next;       /* registry of INA_SLAB_THREADSAFE slabs */
+    struct ina_slab_s *prev;
+};
+
+/* Per thread magazines of INA_SLAB_THREADSAFE slabs */
+#define __INA_SLAB_MAG_SIZE  (32)
+#define __INA_SLAB_MAGS      (8)
+#define __INA_SLAB_MAG_SLOT(slab) ((((uintptr_t)(slab)) >> 6) & (__INA_SLAB_MAGS-1))
+
+typedef struct __ina_slab_mag_s {
+    ina_slab_t *slab;
+    int64_t epoch;
+    size_t count;
+    void *objs[__INA_SLAB_MAG_SIZE];
+} __ina_slab_mag_t;
+
+static volatile int64_t __epoch = 0;
+static INA_TLS(__ina_slab_mag_t) __mags[__INA_SLAB_MAGS];
+static INA_TLS(int) __mags_hooked = 0;
+
+/*
+ * Live INA_SLAB_THREADSAFE slabs. A magazine left by a thread may belong to
+ * a slab that is gone, it is flushed only if the registry still holds it.
+ */
+static ina_slab_t *__slabs = NULL;
+static volatile int64_t __slabs_lock = 0;
+
+#ifdef INA_OS_WIN32
+static volatile int64_t __mags_key_once = 0;
+static DWORD __mags_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_once_t __mags_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __mags_key;
+#endif
+
+INA_INLINE void __ina_slab_lock(ina_slab_t *slab)
+{
+    while (INA_ATOMIC_SWAP(&slab->lock, 0, 1) != 0) {
+    }
+}
+
+INA_INLINE void __ina_slab_unlock(ina_slab_t *slab)
+{
+    INA_ATOMIC_SWAP(&slab->lock, 1, 0);
+}
+
+INA_INLINE void __ina_slabs_lock(void)
+{
+    while (INA_ATOMIC_SWAP(&__slabs_lock, 0, 1) != 0) {
+    }
+}
+
+INA_INLINE void __ina_slabs_unlock(void)
+{
+    INA_ATOMIC_SWAP(&__slabs_lock, 1, 0);
+}
+
+static void __ina_slab_link(__ina_slab_page_t **head, __ina_slab_page_t *page)
+{
+    page->prev = NULL;
+    page->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = page;
+    }
+    *head = page;
+}
+
+static void __ina_slab_unlink(__ina_slab_page_t **head, __ina_slab_page_t *page)
+{
+    if (page->prev != NULL) {
+        page->prev->next = page->next;
+    } else {
+        *head = page->next;
+    }
+    if (page->next != NULL) {
+        page->next->prev = page->prev;
+    }
+}
+
+static void __ina_slab_free_pages(__ina_slab_page_t *page)
+{
+    __ina_slab_page_t *next;
+
+    while (page != NULL) {
+        next = page->next;
+        ina_mem_free_aligned(page);
+        page = next;
+    }
+}
+
+static __ina_slab_page_t *__ina_slab_page_new(ina_slab_t *slab)
+{
+    __ina_slab_page_t *page;
+
+    if (slab->empty != NULL) {
+        page = slab->empty;
+        slab->empty = NULL;
+    } else {
+        page = (__ina_slab_page_t*)ina_mem_alloc_aligned(slab->page_size,
+                                                          slab->page_size);
+        if (page == NULL) {
+            return NULL;
+        }
+        ++slab->npages;
+    }
+    page->slab = slab;
+    page->free = NULL;
+    page->bump = __INA_SLAB_FIRST;
+    page->inuse = 0;
+    __ina_slab_link(&slab->partial, page);
+    return page;
+}
+
+static void *__ina_slab_get(ina_slab_t *slab)
+{
+    __ina_slab_page_t *page = slab->partial;
+    void *ptr;
+
+    if (INA_UNLIKELY(page == NULL)) {
+        page = __ina_slab_page_new(slab);
+        if (page == NULL) {
+            return NULL;
+        }
+    }
+    if (page->free != NULL) {
+        ptr = page->free;
+        page->free = *(void**)ptr;
+    } else {
+        ptr = (unsigned char*)page + page->bump;
+        page->bump += slab->obj_size;
+    }
+    ++slab->inuse;
+    if (++page->inuse == slab->nobj) {
+        __ina_slab_unlink(&slab->partial, page);
+        __ina_slab_link(&slab->full, page);
+    }
+    return ptr;
+}
+
+static void __ina_slab_put(ina_slab_t *slab, void *ptr)
+{
+    __ina_slab_page_t *page = __INA_SLAB_PAGE(slab, ptr);
+
+    INA_ASSERT(page->slab == slab);
+    if (page->inuse == slab->nobj) {
+        __ina_slab_unlink(&slab->full, page);
+        __ina_slab_link(&slab->partial, page);
+    }
+    *(void**)ptr = page->free;
+    page->free = ptr;
+    --slab->inuse;
+    if (--page->inuse > 0) {
+        return;
+    }
+    /* reclaim the page, keep one as spare */
+    __ina_slab_unlink(&slab->partial, page);
+    if (slab->empty == NULL) {
+        slab->empty = page;
+        return;
+    }
+    --slab->npages;
+    ina_mem_free_aligned(page);
+}
+
+/*
+ * Give the objects of a magazine back to its slab if the slab still exists,
+ * otherwise they went away with the pages of the slab.
+ */
+static void __ina_slab_mag_flush(__ina_slab_mag_t *mag)
+{
+    ina_slab_t *slab;
+
+    if (mag->count != 0) {
+        __ina_slabs_lock();
+        for (slab = __slabs; slab != NULL && slab != mag->slab; slab = slab->next) {
+        }
+        if (slab != NULL && slab->epoch == mag->epoch) {
+            __ina_slab_lock(slab);
+            while (mag->count > 0) {
+                __ina_slab_put(slab, mag->objs[--mag->count]);
+            }
+            __ina_slab_unlock(slab);
+        }
+        __ina_slabs_unlock();
+    }
+    mag->slab = NULL;
+    mag->count = 0;
+}
+
+/* Flush the magazines of an exiting thread */
+#ifdef INA_OS_WIN32
+static void WINAPI __ina_slab_thread_exit(void *arg)
+#else
+static void __ina_slab_thread_exit(void *arg)
+#endif
+{
+    int i;
+
+    INA_UNUSED(arg);
+    for (i = 0; i < __INA_SLAB_MAGS; ++i) {
+        __ina_slab_mag_flush(&__mags[i]);
+    }
+}
+
+#ifndef INA_OS_WIN32
+static void __ina_slab_key_create(void)
+{
+    pthread_key_create(&__mags_key, __ina_slab_thread_exit);
+}
+#endif
+
+/* Make sure the magazines of the calling thread are flushed on exit */
+static void __ina_slab_hook_thread(void)
+{
+    if (__mags_hooked) {
+        return;
+    }
+#ifdef INA_OS_WIN32
+    if (__mags_key_once != 2) {
+        if (INA_ATOMIC_SWAP(&__mags_key_once, 0, 1) == 0) {
+            __mags_key = FlsAlloc(__ina_slab_thread_exit);
+            __mags_key_once = 2;
+        }
+        while (__mags_key_once != 2) {
+        }
+    }
+    if (__mags_key != FLS_OUT_OF_INDEXES) {
+        FlsSetValue(__mags_key, (void*)1);
+    }
+#else
+    pthread_once(&__mags_key_once, __ina_slab_key_create);
+    pthread_setspecific(__mags_key, (void*)1);
+#endif
+    __mags_hooked = 1;
+}
+
+/*
+ * Magazine of the calling thread for slab. A magazine left for another slab
+ * or by a former slab at the same address is flushed first.
+ */
+INA_INLINE __ina_slab_mag_t *__ina_slab_mag(ina_slab_t *slab)
+{
+    __ina_slab_mag_t *mag = &__mags[__INA_SLAB_MAG_SLOT(slab)];
+
+    if (INA_LIKELY(mag->slab == slab && mag->epoch == slab->epoch)) {
+        return mag;
+    }
+    __ina_slab_mag_flush(mag);
+    __ina_slab_hook_thread();
+    mag->slab = slab;
+    mag->epoch = slab->epoch;
+    return mag;
+}
+
+INA_API(ina_rc_t) ina_slab_new(size_t obj_size, uint32_t cf, ina_slab_t **slab)
+{
+    INA_VERIFY_NOT_NULL(slab);
+    INA_VERIFY(obj_size > 0);
+
+    if (obj_size < sizeof(void*)) {
+        obj_size = sizeof(void*);
+    }
+    obj_size = INA_MEM_ALIGN(obj_size);
+    if (obj_size > INA_SLAB_PAGE_SIZE - __INA_SLAB_FIRST) {
+        return INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+    }
+    *slab = (ina_slab_t*)ina_mem_alloc(sizeof(ina_slab_t));
+    INA_RETURN_IF_NULL(*slab);
+    INA_MEM_SET_ZERO(*slab, ina_slab_t);
+    (*slab)->cf = cf;
+    (*slab)->obj_size = obj_size;
+    (*slab)->page_size = INA_SLAB_PAGE_SIZE;
+    (*slab)->nobj = (INA_SLAB_PAGE_SIZE - __INA_SLAB_FIRST) / obj_size;
+    (*slab)->epoch = INA_ATOMIC_INC(&__epoch) + 1;
+    if (cf&INA_SLAB_THREADSAFE) {
+        __ina_slabs_lock();
+        (*slab)->next = __slabs;
+        if (__slabs != NULL) {
+            __slabs->prev = *slab;
+        }
+        __slabs = *slab;
+        __ina_slabs_unlock();
+    }
+    return INA_SUCCESS;
+}
+
+INA_API(void) ina_slab_free(ina_slab_t **slab)
+{
+    __ina_slab_mag_t *mag;
+
+    INA_VERIFY_FREE(slab);
+
+    if ((*slab)->cf&INA_SLAB_THREADSAFE) {
+        /* magazines of other threads are dropped when they are used next */
+        __ina_slabs_lock();
+        if ((*slab)->prev != NULL) {
+            (*slab)->prev->next = (*slab)->next;
+        } else {
+            __slabs = (*slab)->next;
+        }
+        if ((*slab)->next != NULL) {
+            (*slab)->next->prev = (*slab)->prev;
+        }
+        __ina_slabs_unlock();
+        mag = &__mags[__INA_SLAB_MAG_SLOT(*slab)];
+        if (mag->slab == *slab) {
+            mag->slab = NULL;
+            mag->count = 0;
+        }
+    }
+    __ina_slab_free_pages((*slab)->partial);
+    __ina_slab_free_pages((*slab)->full);
+    if ((*slab)->empty != NULL) {
+        ina_mem_free_aligned((*slab)->empty);
+    }
+    INA_MEM_FREE_SAFE(*slab);
+}
+
+INA_API(void *) ina_slab_alloc(ina_slab_t *slab)
+{
+    __ina_slab_mag_t *mag;
+    void *ptr;
+
+    INA_ASSERT_NOT_NULL(slab);
+
+    if (!(slab->cf&INA_SLAB_THREADSAFE)) {
+        return __ina_slab_get(slab);
+    }
+    mag = __ina_slab_mag(slab);
+    if (INA_LIKELY(mag->count > 0)) {
+        return mag->objs[--mag->count];
+    }
+    /* refill half of the magazine */
+    __ina_slab_lock(slab);
+    while (mag->count < __INA_SLAB_MAG_SIZE/2 &&
+           (ptr = __ina_slab_get(slab)) != NULL) {
+        mag->objs[mag->count++] = ptr;
+    }
+    __ina_slab_unlock(slab);
+    if (mag->count == 0) {
+        return NULL;
+    }
+    return mag->objs[--mag->count];
+}
+
+INA_API(void) ina_slab_dealloc(ina_slab_t *slab, void *ptr)
+{
+    __ina_slab_mag_t *mag;
+
+    INA_ASSERT_NOT_NULL(slab);
+
+    if (ptr == NULL) {
+        return;
+    }
+    if (!(slab->cf&INA_SLAB_THREADSAFE)) {
+        __ina_slab_put(slab, ptr);
+        return;
+    }
+    mag = __ina_slab_mag(slab);
+    if (INA_UNLIKELY(mag->count == __INA_SLAB_MAG_SIZE)) {
+        /* flush half of the magazine */
+        __ina_slab_lock(slab);
+        while (mag->count > __INA_SLAB_MAG_SIZE/2) {
+            __ina_slab_put(slab, mag->objs[--mag->count]);
+        }
+        __ina_slab_unlock(slab);
+    }
+    mag->objs[mag->count++] = ptr;
+}
+
+INA_API(ina_rc_t) ina_slab_reserve(ina_slab_t *slab, size_t count)
+{
+    size_t avail;
+    __ina_slab_page_t *page;
+
+    INA_VERIFY_NOT_NULL(slab);
+
+    if (slab->cf&INA_SLAB_THREADSAFE) {
+        __ina_slab_lock(slab);
+    }
+    avail = 0;
+    for (page = slab->partial; page != NULL; page = page->next) {
+        avail += slab->nobj - page->inuse;
+    }
+    while (avail < count) {
+        if (__ina_slab_page_new(slab) == NULL) {
+            break;
+        }
+        avail += slab->nobj;
+    }
+    if (slab->cf&INA_SLAB_THREADSAFE) {
+        __ina_slab_unlock(slab);
+    }
+    return avail < count ? ina_err_get_rc() : INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_slab_set_page_size(ina_slab_t *slab, size_t page_size)
+{
+    INA_VERIFY_NOT_NULL(slab);
+
+    if (page_size < INA_SLAB_MIN_PAGE_SIZE || page_size > INA_SLAB_PAGE_SIZE ||
+        (page_size & (page_size - 1)) != 0 ||
+        page_size - __INA_SLAB_FIRST < slab->obj_size) {
+        return INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+    }
+    if (slab->npages != 0) {
+        return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+    }
+    slab->page_size = page_size;
+    slab->nobj = (page_size - __INA_SLAB_FIRST) / slab->obj_size;
+    return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_slab_merge(ina_slab_t *dest, ina_slab_t *src)
+{
+    __ina_slab_page_t *page;
+    __ina_slab_page_t *next;
+
+    INA_VERIFY_NOT_NULL(dest);
+
+    if (src == NULL || src == dest) {
+        return INA_SUCCESS;
+    }
+    if (dest->obj_size != src->obj_size || dest->page_size != src->page_size) {
+        return INA_ERROR(INA_ES_OPERATION | INA_ERR_INVALID);
+    }
+    if (src->cf&INA_SLAB_THREADSAFE) {
+        /* objects cached by the calling thread move with their pages */
+        __ina_slab_mag_t *mag = &__mags[__INA_SLAB_MAG_SLOT(src)];
+        if (mag->slab == src) {
+            __ina_slab_mag_flush(mag);
+        }
+    }
+    if (dest->cf&INA_SLAB_THREADSAFE) {
+        __ina_slab_lock(dest);
+    }
+    if (src->cf&INA_SLAB_THREADSAFE) {
+        __ina_slab_lock(src);
+        /*
+         * Magazines of other threads still hold objects of the moved pages,
+         * a new epoch keeps them from being flushed into src.
+         */
+        src->epoch = INA_ATOMIC_INC(&__epoch) + 1;
+    }
+    for (page = src->partial; page != NULL; page = next) {
+        next = page->next;
+        page->slab = dest;
+        __ina_slab_link(&dest->partial, page);
+    }
+    for (page = src->full; page != NULL; page = next) {
+        next = page->next;
+        page->slab = dest;
+        __ina_slab_link(&dest->full, page);
+    }
+    dest->npages += src->npages;
+    dest->inuse += src->inuse;
+    if (src->empty != NULL) {
+        if (dest->empty == NULL) {
+            dest->empty = src->empty;
+        } else {
+            ina_mem_free_aligned(src->empty);
+            --dest->npages;
+        }
+    }
+    src->partial = NULL;
+    src->full = NULL;
+    src->empty = NULL;
+    src->npages = 0;
+    src->inuse = 0;
+    if (src->cf&INA_SLAB_THREADSAFE) {
+        __ina_slab_unlock(src);
+    }
+    if (dest->cf&INA_SLAB_THREADSAFE) {
+        __ina_slab_unlock(dest);
+    }
+    return INA_SUCCESS;
+}
+
+INA_API(ina_rc_t) ina_slab_info(ina_slab_t *slab, ina_slab_info_t *info)
+{
+    INA_VERIFY_NOT_NULL(slab);
+    INA_VERIFY_NOT_NULL(info);
+
+    info->obj_size = slab->obj_size;
+    info->pages = slab->npages;
+    info->size = slab->npages * slab->page_size;
+    info->used = slab->inuse;
+    return INA_SUCCESS;
+}
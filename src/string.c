@@ -8,6 +8,7 @@
  */
 #include <libinac-ce/lib.h>
 #include "config.h"
+#include "simd.h"
 
 #ifdef INA_OS_WIN32
 INA_INLINE int __ina_vsnprintf(char *str, size_t size, const char *format, va_list args)
@@ -25,84 +26,277 @@ INA_INLINE int __ina_vsnprintf(char *str, size_t size, const char *format, va_li
 #define __ina_vsnprintf vsnprintf
 #endif
 
-#define __INA_HDR_OFFSET(s) (ina_str_hdr_t*)((s)-(sizeof(ina_str_hdr_t)))
-#define __INA_POOLED   80000000UL
+/*
+ * A string is preceded by a header sized by its capacity, short strings get
+ * a header of three bytes. The byte in front of the characters holds the
+ * type of the header and the flags.
+ */
+#define __INA_STR_TYPE_8    (0)
+#define __INA_STR_TYPE_16   (1)
+#define __INA_STR_TYPE_32   (2)
+#define __INA_STR_TYPE_64   (3)
+#define __INA_STR_TYPE_MASK (7)
+/* The string was allocated from a pool */
+#define __INA_STR_POOLED    (8)
+
+#define __INA_STR_FLAGS(s) (((const unsigned char*)(s))[-1])
+#define __INA_STR_TYPE(s)  (__INA_STR_FLAGS(s)&__INA_STR_TYPE_MASK)
+#define __INA_STR_HDR(T, s) ((T*)((char*)(s) - sizeof(T)))
 
 INA_VS_BEGIN_PACK
-typedef struct ina_str_hdr_s {
-    size_t size;
-    size_t len;
+typedef struct __ina_str_hdr8_s {
+    uint8_t len;
+    uint8_t size;
+    uint8_t flags;
+    char data[];
+} INA_PACKED __ina_str_hdr8_t;
+
+typedef struct __ina_str_hdr16_s {
+    uint16_t len;
+    uint16_t size;
+    uint8_t flags;
     char data[];
-} INA_PACKED ina_str_hdr_t;
+} INA_PACKED __ina_str_hdr16_t;
+
+typedef struct __ina_str_hdr32_s {
+    uint32_t len;
+    uint32_t size;
+    uint8_t flags;
+    char data[];
+} INA_PACKED __ina_str_hdr32_t;
+
+typedef struct __ina_str_hdr64_s {
+    uint64_t len;
+    uint64_t size;
+    uint8_t flags;
+    char data[];
+} INA_PACKED __ina_str_hdr64_t;
 INA_VS_END_PACK
 
-INA_INLINE ina_str_hdr_t* __ina_ensure_size(ina_str_hdr_t *hdr, size_t len)
+static const size_t __ina_str_hdr_size[] = {
+    sizeof(__ina_str_hdr8_t),
+    sizeof(__ina_str_hdr16_t),
+    sizeof(__ina_str_hdr32_t),
+    sizeof(__ina_str_hdr64_t)
+};
+
+static double __growth = INA_STR_GROWTH_FACTOR;
+static size_t __growth_max = INA_STR_GROWTH_MAX;
+
+/* Smallest header type for a string of size bytes */
+INA_INLINE int __ina_str_type(size_t size)
 {
-    size_t size;
-    INA_ASSERT_NOT_NULL(hdr);
-    size = (hdr->size & ~(1UL << (31 - 1)));
+    if (size <= UINT8_MAX) {
+        return __INA_STR_TYPE_8;
+    }
+    if (size <= UINT16_MAX) {
+        return __INA_STR_TYPE_16;
+    }
+    if ((uint64_t)size <= UINT32_MAX) {
+        return __INA_STR_TYPE_32;
+    }
+    return __INA_STR_TYPE_64;
+}
 
-    if ((size-hdr->len-1) > len) {
-        return hdr;
+INA_INLINE size_t __ina_str_len(ina_cstr_t s)
+{
+    switch (__INA_STR_TYPE(s)) {
+    case __INA_STR_TYPE_8:
+        return __INA_STR_HDR(__ina_str_hdr8_t, s)->len;
+    case __INA_STR_TYPE_16:
+        return __INA_STR_HDR(__ina_str_hdr16_t, s)->len;
+    case __INA_STR_TYPE_32:
+        return __INA_STR_HDR(__ina_str_hdr32_t, s)->len;
+    default:
+        return (size_t)__INA_STR_HDR(__ina_str_hdr64_t, s)->len;
     }
-    hdr->size = (size-hdr->len)+len;
-    hdr = (ina_str_hdr_t*)ina_mem_realloc(hdr, sizeof(ina_str_hdr_t) + hdr->size);
-    INA_ASSERT_NOT_NULL(hdr);
-    return hdr;
 }
 
-INA_INLINE ina_str_hdr_t* __ina_ensure_size_pool(ina_mempool_t *pool, ina_str_hdr_t *hdr, size_t len)
+INA_INLINE size_t __ina_str_size(ina_cstr_t s)
 {
-    size_t old_size = hdr->size;
-    size_t size;
+    switch (__INA_STR_TYPE(s)) {
+    case __INA_STR_TYPE_8:
+        return __INA_STR_HDR(__ina_str_hdr8_t, s)->size;
+    case __INA_STR_TYPE_16:
+        return __INA_STR_HDR(__ina_str_hdr16_t, s)->size;
+    case __INA_STR_TYPE_32:
+        return __INA_STR_HDR(__ina_str_hdr32_t, s)->size;
+    default:
+        return (size_t)__INA_STR_HDR(__ina_str_hdr64_t, s)->size;
+    }
+}
 
-    INA_ASSERT_NOT_NULL(hdr);
-    INA_ASSERT_TRUE(hdr->size&__INA_POOLED);
+/* Set the length and terminate the string */
+INA_INLINE void __ina_str_set_len(ina_str_t s, size_t len)
+{
+    switch (__INA_STR_TYPE(s)) {
+    case __INA_STR_TYPE_8:
+        __INA_STR_HDR(__ina_str_hdr8_t, s)->len = (uint8_t)len;
+        break;
+    case __INA_STR_TYPE_16:
+        __INA_STR_HDR(__ina_str_hdr16_t, s)->len = (uint16_t)len;
+        break;
+    case __INA_STR_TYPE_32:
+        __INA_STR_HDR(__ina_str_hdr32_t, s)->len = (uint32_t)len;
+        break;
+    default:
+        __INA_STR_HDR(__ina_str_hdr64_t, s)->len = (uint64_t)len;
+        break;
+    }
+    s[len] = '\0';
+}
 
-    size = (hdr->size & ~(1UL << (31 - 1)));
-    if ((size-hdr->len-1) > len) {
-        return hdr;
+INA_INLINE void __ina_str_set_size(ina_str_t s, size_t size)
+{
+    switch (__INA_STR_TYPE(s)) {
+    case __INA_STR_TYPE_8:
+        __INA_STR_HDR(__ina_str_hdr8_t, s)->size = (uint8_t)size;
+        break;
+    case __INA_STR_TYPE_16:
+        __INA_STR_HDR(__ina_str_hdr16_t, s)->size = (uint16_t)size;
+        break;
+    case __INA_STR_TYPE_32:
+        __INA_STR_HDR(__ina_str_hdr32_t, s)->size = (uint32_t)size;
+        break;
+    default:
+        __INA_STR_HDR(__ina_str_hdr64_t, s)->size = (uint64_t)size;
+        break;
     }
+}
 
-    hdr->size = (size-hdr->len)+len;
-    hdr = (ina_str_hdr_t*)ina_mempool_ralloc(pool, hdr,
-                                             sizeof(ina_str_hdr_t) + old_size,
-                                             sizeof(ina_str_hdr_t) + hdr->size);
-    hdr->size = hdr->size|__INA_POOLED;
-    INA_ASSERT_NOT_NULL(hdr);
-    return hdr;
+/* Start of the memory block of a string */
+INA_INLINE char *__ina_str_base(ina_cstr_t s)
+{
+    return (char*)s - __ina_str_hdr_size[__INA_STR_TYPE(s)];
 }
 
-INA_API(ina_str_t) ina_str_new(size_t len)
+/* Write a header to the memory block m */
+INA_INLINE ina_str_t __ina_str_init(void *m, int type, int flags, size_t size,
+                                    size_t len)
+{
+    ina_str_t s = (char*)m + __ina_str_hdr_size[type];
+
+    s[-1] = (char)(type|flags);
+    __ina_str_set_size(s, size);
+    __ina_str_set_len(s, len);
+    return s;
+}
+
+/* Allocate an empty string of size bytes, from the heap if pool is NULL */
+static ina_str_t __ina_str_alloc(size_t size, ina_mempool_t *pool)
 {
-    ina_str_hdr_t *hdr;
-    hdr = (ina_str_hdr_t*)ina_mem_alloc(len + 1 + sizeof(ina_str_hdr_t));
-    if (hdr == NULL) {
+    int type = __ina_str_type(size);
+    void *m;
+
+    if (pool != NULL) {
+        m = ina_mempool_dalloc(pool, __ina_str_hdr_size[type] + size);
+    } else {
+        m = ina_mem_alloc(__ina_str_hdr_size[type] + size);
+    }
+    if (m == NULL) {
         return NULL;
     }
-    hdr->size = len+1;
-    hdr->len = 0;
-    hdr->data[0] = '\0';
-    return (ina_str_t)hdr->data; 
+    return __ina_str_init(m, type, pool != NULL ? __INA_STR_POOLED : 0, size, 0);
 }
 
-INA_API(ina_str_t) ina_str_new_using_pool(size_t len, ina_mempool_t *pool)
+/* Size for a string of len characters with room to grow */
+INA_INLINE size_t __ina_str_grow_size(size_t len)
+{
+    size_t need = len + 1;
+    size_t size = (size_t)((double)need*__growth);
+
+    if (size < need) {
+        size = need;
+    }
+    if (__growth_max != 0 && size - need > __growth_max) {
+        size = need + __growth_max;
+    }
+    return size;
+}
+
+/*
+ * Make room for a string of len characters, size is the new size or 0 to
+ * grow by the growth policy. A larger header moves the characters. Returns
+ * NULL and leaves s untouched if no memory is left or a pooled string has to
+ * grow without its pool.
+ */
+static ina_str_t __ina_str_make_room(ina_str_t s, size_t len, size_t size,
+                                     ina_mempool_t *pool)
+{
+    int type = __INA_STR_TYPE(s);
+    int flags = __INA_STR_FLAGS(s)&~__INA_STR_TYPE_MASK;
+    size_t hdr = __ina_str_hdr_size[type];
+    size_t old_size = __ina_str_size(s);
+    size_t slen;
+    size_t nhdr;
+    char *m;
+
+    if (len < old_size) {
+        return s;
+    }
+    if (size == 0) {
+        size = __ina_str_grow_size(len);
+    }
+    slen = __ina_str_len(s);
+    type = __ina_str_type(size);
+    nhdr = __ina_str_hdr_size[type];
+    if (flags&__INA_STR_POOLED) {
+        if (pool == NULL) {
+            INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+            return NULL;
+        }
+        m = (char*)ina_mempool_ralloc(pool, s - hdr, hdr + old_size, nhdr + size);
+    } else {
+        m = (char*)ina_mem_realloc(s - hdr, nhdr + size);
+    }
+    if (m == NULL) {
+        return NULL;
+    }
+    if (nhdr != hdr) {
+        ina_mem_move(m + nhdr, m + hdr, slen);
+    }
+    return __ina_str_init(m, type, flags, size, slen);
+}
+
+INA_API(ina_rc_t) ina_str_set_growth(double factor, size_t max)
+{
+    if (factor < 1.0) {
+        return INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+    }
+    __growth = factor;
+    __growth_max = max;
+    return INA_SUCCESS;
+}
+
+INA_API(ina_str_t) ina_str_reserve(ina_str_t str, size_t len)
+{
+    INA_ASSERT_NOT_NULL(str);
+    return __ina_str_make_room(str, len, len + 1, NULL);
+}
+
+INA_API(ina_str_t) ina_str_reserve_using_pool(ina_str_t str, size_t len,
+                                              ina_mempool_t *pool)
+{
+    INA_ASSERT_NOT_NULL(str);
+    return __ina_str_make_room(str, len, len + 1, pool);
+}
+
+INA_API(ina_str_t) ina_str_new(size_t len)
 {
-    ina_str_hdr_t *hdr;
+    return __ina_str_alloc(len + 1, NULL);
+}
 
-    hdr = (ina_str_hdr_t*)ina_mempool_dalloc(pool,len+1+sizeof(ina_str_hdr_t));
-    if (hdr == NULL) {
+INA_API(ina_str_t) ina_str_new_using_pool(size_t len, ina_mempool_t *pool)
+{
+    if (pool == NULL) {
+        INA_ERROR(INA_ERR_INVALID_ARGUMENT);
         return NULL;
     }
-    hdr->size = __INA_POOLED|(len+1);
-    hdr->len = 0;
-    hdr->data[0] = '\0';
-    return (ina_str_t)hdr->data; 
+    return __ina_str_alloc(len + 1, pool);
 }
 
 INA_API(ina_str_t) ina_str_new_fromblk(const void* blk, size_t len) 
 {
-    ina_str_hdr_t *hdr;
     ina_str_t str;
 
     if (blk == NULL) {
@@ -114,12 +308,10 @@ INA_API(ina_str_t) ina_str_new_fromblk(const void* blk, size_t len)
     if (str == NULL)  {
         return NULL;
     }
-    hdr = __INA_HDR_OFFSET(str);
     if (len > 0) {
         INA_MEM_MEMCPY(str, blk, len);
     }
-    hdr->len = len;
-    str[len]='\0';
+    __ina_str_set_len(str, len);
     return str;
 }
 
@@ -146,6 +338,7 @@ INA_API(ina_str_t) ina_str_new_fromblk_using_pool(const void* blk,
     if (len > 0) {
         ina_mem_cpy(str, blk, len);
     }
+    __ina_str_set_len(str, len);
     return str;
 }
 
@@ -166,8 +359,7 @@ INA_API(ina_str_t) ina_str_new_fromcstr(const char* cstr)
     if (cstr != NULL) {
         ina_mem_cpy(str, cstr, len);
     }
-    (__INA_HDR_OFFSET(str))->len = len;
-    str[len]='\0';
+    __ina_str_set_len(str, len);
     return str;
 }
 
@@ -191,112 +383,89 @@ INA_API(ina_str_t) ina_str_new_fromcstr_using_pool(const char* cstr,
     if (cstr != NULL) {
         ina_mem_cpy(str, cstr, len);
     }
-    (__INA_HDR_OFFSET(str))->len = len;
+    __ina_str_set_len(str, len);
     return str;
 }
 
 INA_API(ina_rc_t) ina_str_free(ina_str_t str)
 {
-    if (str != NULL) {
-        ina_str_hdr_t *hdr = __INA_HDR_OFFSET(str);
-        if (!(hdr->size&__INA_POOLED)) {
-            ina_mem_free(hdr);
-        }
+    if (str != NULL && !(__INA_STR_FLAGS(str)&__INA_STR_POOLED)) {
+        ina_mem_free(__ina_str_base(str));
     }
     return INA_SUCCESS;
 }
 
 INA_API(ina_str_t) ina_str_ncpy(ina_str_t dest,  ina_cstr_t src, size_t n)
 {
-    ina_str_hdr_t *d;
-
     INA_ASSERT_NOT_NULL(dest);
 
     if (src == NULL) {
         return dest;
     }
 
-    d = __INA_HDR_OFFSET(dest);
-    d = __ina_ensure_size(d, n);
-    ina_mem_cpy(d->data, src, n);
-    d->data[n] = 0;
-    d->len = n;
-    return d->data;
+    dest = __ina_str_make_room(dest, n, 0, NULL);
+    if (dest == NULL) {
+        return NULL;
+    }
+    ina_mem_cpy(dest, src, n);
+    __ina_str_set_len(dest, n);
+    return dest;
 }
 
+INA_INLINE ina_str_t __ina_str_ncat(ina_str_t dest, const char *src, size_t n,
+                                    ina_mempool_t *pool)
+{
+    size_t len = __ina_str_len(dest);
+
+    dest = __ina_str_make_room(dest, len + n, 0, pool);
+    if (dest == NULL) {
+        return NULL;
+    }
+    ina_mem_cpy(dest + len, src, n);
+    __ina_str_set_len(dest, len + n);
+    return dest;
+}
 
 INA_API(ina_str_t) ina_str_ncat(ina_str_t dest, ina_cstr_t src, size_t n)
 {
-    ina_str_hdr_t *d;
-
     INA_ASSERT_NOT_NULL(dest);
 
     if (src == NULL) {
         return dest;
     }
-
-    d = __INA_HDR_OFFSET(dest);
-    d = __ina_ensure_size(d, d->len+n);
-    ina_mem_cpy(&d->data[d->len], src, n);
-    d->len += n;
-    d->data[d->len] = '\0';
-    return (ina_str_t)d->data;
+    return __ina_str_ncat(dest, src, n, NULL);
 }
 
 INA_API(ina_str_t) ina_str_ncat_using_pool(ina_str_t dest, ina_cstr_t src, size_t n, ina_mempool_t *pool)
 {
-    ina_str_hdr_t *d;
-
     INA_ASSERT_NOT_NULL(dest);
 
     if (src == NULL) {
         return dest;
     }
-
-    d = __INA_HDR_OFFSET(dest);
-    d = __ina_ensure_size_pool(pool, d, d->len+n);
-    ina_mem_cpy(&d->data[d->len], src, n);
-    d->len += n;
-    d->data[d->len] = '\0';
-    return (ina_str_t)d->data;
+    return __ina_str_ncat(dest, src, n, pool);
 }
 
 INA_API(ina_str_t) ina_str_ncatcstr(ina_str_t dest, const char *src, size_t n)
 {
-    ina_str_hdr_t *d;
-
     INA_ASSERT_NOT_NULL(dest);
-    INA_ASSERT_TRUE(strlen(src) <= n);
 
     if (src == NULL) {
         return dest;
     }
-
-    d = __INA_HDR_OFFSET(dest);
-    d = __ina_ensure_size(d, d->len+n);
-    ina_mem_cpy(&d->data[d->len], src, n);
-    d->len += n;
-    d->data[d->len] = '\0';
-    return (ina_str_t)d->data;
+    INA_ASSERT_TRUE(strlen(src) <= n);
+    return __ina_str_ncat(dest, src, n, NULL);
 }
 
 INA_API(ina_str_t) ina_str_ncatcstr_using_pool(ina_str_t dest, const char *src, size_t n, ina_mempool_t *pool)
 {
-    ina_str_hdr_t *d;
-
     INA_ASSERT_NOT_NULL(dest);
-    INA_ASSERT_TRUE(strlen(src) <= n);
 
     if (src == NULL) {
         return dest;
     }
-
-    d = __INA_HDR_OFFSET(dest);
-    d = __ina_ensure_size_pool(pool, d, d->len+n);
-    ina_mem_cpy(&d->data[d->len], src, n);
-    d->len += n;
-    d->data[d->len] = '\0';
-    return (ina_str_t)d->data;
+    INA_ASSERT_TRUE(strlen(src) <= n);
+    return __ina_str_ncat(dest, src, n, pool);
 }
 
 INA_API(int) ina_str_cmp(ina_cstr_t lhs, ina_cstr_t rhs)
@@ -322,7 +491,7 @@ INA_API(size_t) ina_str_len(ina_cstr_t str)
     if (str == NULL) {
         return 0;
     }
-    return (__INA_HDR_OFFSET(str))->len;
+    return __ina_str_len(str);
 }
 
 INA_API(size_t) ina_str_size(ina_cstr_t str)
@@ -330,7 +499,7 @@ INA_API(size_t) ina_str_size(ina_cstr_t str)
     if (str == NULL) {
         return 0;
     }
-    return (__INA_HDR_OFFSET(str))->size;
+    return __ina_str_size(str);
 }
 
 INA_API(size_t) ina_str_available(ina_cstr_t str)
@@ -338,7 +507,7 @@ INA_API(size_t) ina_str_available(ina_cstr_t str)
     if (str == NULL) {
         return 0;
     }
-    return (__INA_HDR_OFFSET(str))->size -(__INA_HDR_OFFSET(str))->len-1;
+    return __ina_str_size(str) - __ina_str_len(str) - 1;
 }
 
 INA_API(ina_str_t) ina_str_toupper(ina_str_t str)
@@ -370,9 +539,8 @@ INA_API(ina_str_t) ina_str_tolower(ina_str_t str)
 INA_API(ina_str_t) ina_str_truncate(ina_str_t str, size_t pos)
 {
     if (str != NULL) {
-        INA_ASSERT_TRUE(pos <= (__INA_HDR_OFFSET(str))->len);
-        (__INA_HDR_OFFSET(str))->len = pos;
-        (__INA_HDR_OFFSET(str))->data[pos] = '\0';
+        INA_ASSERT_TRUE(pos <= __ina_str_len(str));
+        __ina_str_set_len(str, pos);
     }
     return str;
 }
@@ -381,12 +549,11 @@ INA_API(ina_str_t) ina_str_trim(ina_str_t str, const char* chars)
 {
     INA_ASSERT_NOT_NULL(str);
     if (chars != NULL) {
-        ina_str_hdr_t *hdr = __INA_HDR_OFFSET(str);
         char *start, *end, *sp, *ep;
         size_t len;
 
         sp = start = str;
-        ep = end = str+(hdr->len)-1;
+        ep = end = str+__ina_str_len(str)-1;
         while(sp <= end && strchr(chars, *sp)) {
             sp++;
         }
@@ -398,11 +565,10 @@ INA_API(ina_str_t) ina_str_trim(ina_str_t str, const char* chars)
         } else {
             len = ((ep-sp)+1);
         }
-        if (hdr->data != sp) {
-            ina_mem_move(hdr->data, sp, len);
+        if (str != sp) {
+            ina_mem_move(str, sp, len);
         }
-        hdr->data[len] = '\0';
-        hdr->len = len;
+        __ina_str_set_len(str, len);
     }
     return str;   
 }
@@ -441,7 +607,7 @@ INA_API(ina_str_t) ina_str_substr_using_pool(ina_cstr_t str, size_t start, size_
     INA_ASSERT_NOT_NULL(str);
 
     newlen = __ina_str_substr_internal(start, end, ina_str_len(str));
-    return ina_str_new_fromblk_using_pool((__INA_HDR_OFFSET(str))->data+start, newlen, pool);
+    return ina_str_new_fromblk_using_pool(str+start, newlen, pool);
 }
 
 INA_API(ina_str_t) ina_str_substr(ina_cstr_t str, size_t start, size_t end)
@@ -451,14 +617,15 @@ INA_API(ina_str_t) ina_str_substr(ina_cstr_t str, size_t start, size_t end)
     INA_ASSERT_NOT_NULL(str);
 
     newlen = __ina_str_substr_internal(start, end, ina_str_len(str));
-    return ina_str_new_fromblk((__INA_HDR_OFFSET(str))->data+start, newlen);
+    return ina_str_new_fromblk(str+start, newlen);
 }
 
 INA_API(ina_str_t*) ina_str_split(const char *str, const char *sep, size_t *count)
 {
-    size_t elements = 0, slots = 5, j, start = 0, seplen, len;
+    size_t elements = 0, slots = 1, seplen, len;
+    const char *last, *p, *q;
     ina_str_t *tokens;
-    
+
     if (str == NULL) {
         if (count != NULL) {
             *count = 0;
@@ -474,51 +641,41 @@ INA_API(ina_str_t*) ina_str_split(const char *str, const char *sep, size_t *coun
     }
 
     len = strlen(str);
-    seplen = strlen(sep);    
+    seplen = strlen(sep);
     if (len == 0 || seplen == 0) {
         if (count != NULL) {
             *count = 0;
         }
-        return NULL;        
-    }     
+        return NULL;
+    }
 
-    tokens = ina_mem_alloc(sizeof(ina_str_t)*slots);
+    /* a separator starting at the last character does not split */
+    last = str + len - 1;
+    for (p = str; (q = __ina_mem_find(p, len - (size_t)(p - str), sep, seplen)) != NULL &&
+                  q < last; p = q + seplen) {
+        slots++;
+    }
+    /* room for the final element and the terminator */
+    tokens = ina_mem_alloc(sizeof(ina_str_t)*(slots + 1));
     if (tokens == NULL) {
         return NULL;
     }
 
-    for (j = 0; j < (len-1); j++) {
-        /* make sure there is room for the next element and the final one
-         * and the terminator */
-        if (slots < elements+3) {
-            ina_str_t *newtokens;
-            newtokens = ina_mem_alloc(sizeof(ina_str_t)*slots*2);
-            INA_FAIL_IF(newtokens == NULL);
-            ina_mem_cpy(newtokens, tokens, sizeof(ina_str_t)*slots);
-            slots *=2;
-            ina_mem_free(tokens);
-            tokens = newtokens;
-        }
-        /* search the separator */
-        /* FIXME: Optimize */
-        if ((seplen == 1 && *(str+j) == sep[0]) ||
-            (ina_mem_cmp(str+j,sep,seplen) == 0)) {
-            tokens[elements] = ina_str_new_fromblk(str+start,j-start);
-            INA_FAIL_IF(tokens[elements] == NULL);
-            elements++;
-            start = j+seplen;
-            j = j+seplen-1; /* skip the separator */
-        }
+    for (p = str; elements + 1 < slots; p = q + seplen) {
+        q = __ina_mem_find(p, len - (size_t)(p - str), sep, seplen);
+        tokens[elements] = ina_str_new_fromblk(p, (size_t)(q - p));
+        INA_FAIL_IF(tokens[elements] == NULL);
+        elements++;
     }
-    /* Add the final element. We are sure there is room in the tokens array. */
-    tokens[elements] = ina_str_new_fromblk(str+start, len-start);
+    /* Add the final element. */
+    tokens[elements] = ina_str_new_fromblk(p, len - (size_t)(p - str));
     INA_FAIL_IF(tokens[elements] == NULL);
     elements++;
     if (count != NULL) {
         *count = elements;
     }
-    /* Add the terminator element. We are sure there is room in the array. */
-    tokens[elements] = NULL; 
+    /* Add the terminator element. */
+    tokens[elements] = NULL;
     return tokens;
 
 fail:
@@ -594,37 +751,41 @@ INA_API(const char*) ina_str_tok(char *str, const char *sep, char **next)
 
 INA_API(ina_str_t) ina_str_assign_buf(char* buf, size_t len)
 {
-    ina_str_hdr_t *hdr;
+    int type;
+
     if (NULL == buf) {
         INA_ERROR(INA_ERR_INVALID_ARGUMENT);
         return NULL;
     }
-    if (len < sizeof(ina_str_hdr_t) ||
-        len > (INT_MAX- sizeof(ina_str_hdr_t))) {
+    if (len <= __ina_str_hdr_size[__INA_STR_TYPE_8] || len > INT_MAX) {
         INA_ERROR(INA_ERR_INVALID_ARGUMENT);
         return NULL;
     }
-    hdr = (ina_str_hdr_t*)buf;
-    hdr->size = (uint32_t )len - sizeof(ina_str_hdr_t);
-    hdr->len = 0;
-    hdr->data[0] = '\0';
-    return &hdr->data[0];
+    /* the smallest header that can describe the rest of the buffer */
+    type = __INA_STR_TYPE_8;
+    while (__ina_str_type(len - __ina_str_hdr_size[type]) > type) {
+        ++type;
+    }
+    return __ina_str_init(buf, type, 0, len - __ina_str_hdr_size[type], 0);
 }
 
 INA_API(char *) ina_str_release_buf(ina_str_t str)
 {
+    char *buf;
+
     if (str == NULL) {
         INA_ERROR(INA_ERR_INVALID_ARGUMENT);
+        return NULL;
     }
-    ina_str_hdr_t *hdr = __INA_HDR_OFFSET(str);
-    ina_mem_move(hdr, str, hdr->len);
-    return (char*)hdr;
+    buf = __ina_str_base(str);
+    ina_mem_move(buf, str, __ina_str_len(str));
+    return buf;
 }
 
 INA_API(ina_str_t) ina_str_adjust_len(ina_str_t str)
 {
     INA_ASSERT_NOT_NULL(str);
-    (__INA_HDR_OFFSET(str))->len = strlen(str);
+    __ina_str_set_len(str, strlen(str));
     return str;
 }
 
@@ -679,7 +840,7 @@ INA_API(int) ina_str_vsnprintf(ina_str_t *str, size_t len, const char* fmt,
     INA_ASSERT_NOT_NULL(fmt);
     INA_ASSERT_NOT_NULL(str);
     INA_ASSERT_TRUE(len > 0);
-    INA_ASSERT_FALSE((__INA_HDR_OFFSET(*str))->size < len);
+    INA_ASSERT_FALSE(__ina_str_size(*str) < len);
  
     va_copy(args_copy, args);
     if ((l = __ina_vsnprintf(*str, len, fmt, args)) >= (int)len) {
@@ -693,7 +854,7 @@ INA_API(int) ina_str_vsnprintf(ina_str_t *str, size_t len, const char* fmt,
         }
     }
     if (l >= 0) {
-        (__INA_HDR_OFFSET(*str))->len = (size_t)l;
+        __ina_str_set_len(*str, (size_t)l);
     }
     va_end(args_copy);
     return l;    
@@ -784,5 +945,204 @@ INA_API(ina_rc_t) ina_str_wildcard_match(ina_cstr_t tame, const char *wildcard)
     }
 }
 
+/* Set of characters, e.g. separators */
+typedef struct __ina_charset_s {
+    uint32_t map[256/32];
+} __ina_charset_t;
+
+INA_INLINE void __ina_charset_init(__ina_charset_t *set, const char *chars)
+{
+    const unsigned char *c = (const unsigned char*)chars;
+
+    ina_mem_set(set, 0, sizeof(__ina_charset_t));
+    while (*c) {
+        set->map[*c >> 5] |= 1u << (*c & 31);
+        ++c;
+    }
+}
+
+INA_INLINE int __ina_charset_has(const __ina_charset_t *set, char chr)
+{
+    unsigned char c = (unsigned char)chr;
+    return (set->map[c >> 5] >> (c & 31)) & 1;
+}
+
+INA_API(ina_str_t) ina_strview_to_str(ina_strview_t view)
+{
+    return ina_str_new_fromblk(view.len > 0 ? view.ptr : "", view.len);
+}
+
+INA_API(ina_str_t) ina_strview_to_str_using_pool(ina_strview_t view,
+                                                 ina_mempool_t *pool)
+{
+    return ina_str_new_fromblk_using_pool(view.len > 0 ? view.ptr : "", view.len,
+                                          pool);
+}
+
+INA_API(int) ina_strview_cmp(ina_strview_t lhs, ina_strview_t rhs)
+{
+    size_t minlen = INA_MIN(lhs.len, rhs.len);
+    int cmp;
+
+    if (minlen > 0 && (cmp = ina_mem_cmp(lhs.ptr, rhs.ptr, minlen)) != 0) {
+        return cmp;
+    }
+    if (lhs.len == rhs.len) {
+        return 0;
+    }
+    return lhs.len < rhs.len ? -1 : 1;
+}
+
+INA_API(const char*) ina_strview_find(ina_strview_t view, ina_strview_t needle)
+{
+    return __ina_mem_find(view.ptr, view.len, needle.ptr, needle.len);
+}
+
+INA_API(const char*) ina_strview_chr(ina_strview_t view, char chr)
+{
+    if (view.len == 0) {
+        return NULL;
+    }
+    return (const char*)memchr(view.ptr, chr, view.len);
+}
+
+INA_API(ina_strview_t) ina_strview_substr(ina_strview_t view, size_t start,
+        size_t end)
+{
+    size_t newlen;
+
+    newlen = __ina_str_substr_internal(start, end, view.len);
+    if (newlen == 0) {
+        return ina_strview_fromblk(view.ptr, 0);
+    }
+    return ina_strview_fromblk(view.ptr + start, newlen);
+}
+
+INA_API(ina_strview_t) ina_strview_trim(ina_strview_t view, const char *chars)
+{
+    __ina_charset_t set;
+
+    if (chars == NULL) {
+        return view;
+    }
+    __ina_charset_init(&set, chars);
+    while (view.len > 0 && __ina_charset_has(&set, view.ptr[0])) {
+        ++view.ptr;
+        --view.len;
+    }
+    while (view.len > 0 && __ina_charset_has(&set, view.ptr[view.len - 1])) {
+        --view.len;
+    }
+    return view;
+}
+
+INA_API(ina_strview_t*) ina_strview_split(ina_strview_t view, const char *sep,
+        size_t *count)
+{
+    ina_strview_t *tokens;
+    const char *end;
+    const char *p;
+    size_t seplen;
+    size_t n;
+
+    if (count != NULL) {
+        *count = 0;
+    }
+    if (sep == NULL || view.len == 0 || (seplen = strlen(sep)) == 0) {
+        return NULL;
+    }
+    end = view.ptr + view.len;
+
+    /* count first, the views go to a single allocation */
+    n = 1;
+    for (p = view.ptr; (p = __ina_mem_find(p, (size_t)(end - p), sep, seplen)) != NULL; p += seplen) {
+        ++n;
+    }
+    tokens = (ina_strview_t*)ina_mem_alloc(n*sizeof(ina_strview_t));
+    if (tokens == NULL) {
+        return NULL;
+    }
+    n = 0;
+    for (p = view.ptr; ; ) {
+        const char *q = __ina_mem_find(p, (size_t)(end - p), sep, seplen);
+        if (q == NULL) {
+            tokens[n++] = ina_strview_fromblk(p, (size_t)(end - p));
+            break;
+        }
+        tokens[n++] = ina_strview_fromblk(p, (size_t)(q - p));
+        p = q + seplen;
+    }
+    if (count != NULL) {
+        *count = n;
+    }
+    return tokens;
+}
+
+INA_API(int) ina_strview_tok(ina_strview_t *view, const char *sep,
+                             ina_strview_t *tok)
+{
+    __ina_charset_t set;
+    size_t i;
+
+    INA_ASSERT_NOT_NULL(view);
+    INA_ASSERT_NOT_NULL(tok);
 
+    __ina_charset_init(&set, sep != NULL ? sep : "");
+    while (view->len > 0 && __ina_charset_has(&set, view->ptr[0])) {
+        ++view->ptr;
+        --view->len;
+    }
+    if (view->len == 0) {
+        *tok = *view;
+        return 0;
+    }
+    for (i = 1; i < view->len && !__ina_charset_has(&set, view->ptr[i]); ++i) {
+    }
+    *tok = ina_strview_fromblk(view->ptr, i);
+    /* skip the separator behind the token */
+    if (i < view->len) {
+        ++i;
+    }
+    view->ptr += i;
+    view->len -= i;
+    return 1;
+}
 
+INA_API(void) ina_str_split_iter_init(ina_str_split_iter_t *iter,
+                                      ina_strview_t view, const char *sep)
+{
+    INA_ASSERT_NOT_NULL(iter);
+
+    iter->rest = view;
+    iter->sep = sep;
+    iter->seplen = sep != NULL ? strlen(sep) : 0;
+    iter->done = view.len == 0 || iter->seplen == 0;
+}
+
+INA_API(int) ina_str_split_iter_next(ina_str_split_iter_t *iter,
+                                     ina_strview_t *tok)
+{
+    const char *q;
+    size_t n;
+
+    INA_ASSERT_NOT_NULL(iter);
+    INA_ASSERT_NOT_NULL(tok);
+
+    if (iter->done) {
+        return 0;
+    }
+    q = __ina_mem_find(iter->rest.ptr, iter->rest.len, iter->sep, iter->seplen);
+    if (q == NULL) {
+        /* the rest is the last token */
+        *tok = iter->rest;
+        iter->rest.ptr += iter->rest.len;
+        iter->rest.len = 0;
+        iter->done = 1;
+        return 1;
+    }
+    n = (size_t)(q - iter->rest.ptr);
+    *tok = ina_strview_fromblk(iter->rest.ptr, n);
+    iter->rest.ptr = q + iter->seplen;
+    iter->rest.len -= n + iter->seplen;
+    return 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#ifndef _INA_TEST_H_
+#define _INA_TEST_H_
+
+#include <libinac-ce/lib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Checks stay active in release builds, unlike INA_ASSERT */
+#define INA_TEST_ASSERT(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+#define INA_TEST_ASSERT_SUCCEED(rc) INA_TEST_ASSERT(INA_SUCCEED(rc))
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#define IS_ALIGNED(p, a) ((((uintptr_t)(p)) & ((a) - 1)) == 0)
+
+static void fill(unsigned char *p, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        p[i] = (unsigned char)(i * 7);
+    }
+}
+
+static int check(const unsigned char *p, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p[i] != (unsigned char)(i * 7)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_alloc(void)
+{
+    size_t sizes[] = { 1, 100, 4096, 100000, 1024*1024, 3*1024*1024 + 5 };
+    size_t alignments[] = { 8, 64, 4096, 64*1024 };
+    unsigned char *p;
+    size_t i, j;
+
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        for (j = 0; j < sizeof(alignments)/sizeof(alignments[0]); j++) {
+            p = ina_mem_alloc_aligned(alignments[j], sizes[i]);
+            INA_TEST_ASSERT(p != NULL);
+            INA_TEST_ASSERT(IS_ALIGNED(p, alignments[j]));
+            fill(p, sizes[i]);
+            INA_TEST_ASSERT(check(p, sizes[i]));
+            ina_mem_free_aligned(p);
+        }
+    }
+}
+
+/* grow from the heap into a mapping and back, the content is kept */
+static void test_realloc(size_t alignment)
+{
+    size_t sizes[] = { 1000, 300*1024, 2*1024*1024, 9*1024*1024, 500*1024, 64 };
+    size_t i, n = 100;
+    unsigned char *p;
+
+    p = ina_mem_alloc_aligned(alignment, n);
+    INA_TEST_ASSERT(p != NULL);
+    fill(p, n);
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        p = ina_mem_realloc_aligned(p, alignment, sizes[i]);
+        INA_TEST_ASSERT(p != NULL);
+        INA_TEST_ASSERT(IS_ALIGNED(p, alignment));
+        INA_TEST_ASSERT(check(p, INA_MIN(n, sizes[i])));
+        n = sizes[i];
+        fill(p, n);
+    }
+    ina_mem_free_aligned(p);
+}
+
+/* a failed resize leaves the block as it was */
+static void test_realloc_fail(void)
+{
+    size_t sizes[] = { 1000, 2*1024*1024 };
+    unsigned char *p, *q;
+    size_t i;
+
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        p = ina_mem_alloc_aligned(64, sizes[i]);
+        INA_TEST_ASSERT(p != NULL);
+        fill(p, sizes[i]);
+        q = ina_mem_realloc_aligned(p, 64, (size_t)1 << (sizeof(size_t)*8 - 2));
+        INA_TEST_ASSERT(q == NULL);
+        INA_TEST_ASSERT(check(p, sizes[i]));
+        ina_mem_free_aligned(p);
+    }
+}
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_alloc();
+    test_realloc(64);
+    test_realloc(4096);
+    test_realloc(64*1024);
+    test_realloc_fail();
+    return 0;
+}
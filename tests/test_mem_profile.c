@@ -0,0 +1,72 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#ifndef INA_OS_WIN32
+#include <pthread.h>
+#endif
+
+#define NSITES   300
+#define NTHREADS 20
+
+static char sites[NSITES][16];
+
+static void *record(void *arg)
+{
+    int i;
+
+    INA_UNUSED(arg);
+    for (i = 0; i < NSITES; i++) {
+        ina_mem_profile_free(sites[i], ina_mem_profile_alloc(sites[i], 1 + (size_t)i));
+    }
+    return NULL;
+}
+
+/* call sites of many threads are merged, the tables grow with the sites */
+static void test_report(int nthreads)
+{
+    ina_mem_profile_entry_t *e;
+    size_t n, i;
+
+    ina_mem_profile_reset();
+    for (i = 0; i < (size_t)nthreads; i++) {
+#ifndef INA_OS_WIN32
+        pthread_t th;
+        INA_TEST_ASSERT(pthread_create(&th, NULL, record, NULL) == 0);
+        pthread_join(th, NULL);
+#else
+        record(NULL);
+#endif
+    }
+    INA_TEST_ASSERT_SUCCEED(ina_mem_profile_report(&e, &n));
+    INA_TEST_ASSERT(n == NSITES);
+    for (i = 0; i < n; i++) {
+        INA_TEST_ASSERT(strncmp(e[i].at, "site", 4) == 0);
+        INA_TEST_ASSERT(e[i].calls == (uint64_t)nthreads);
+        INA_TEST_ASSERT(e[i].frees == (uint64_t)nthreads);
+    }
+    /* sorted by bytes */
+    INA_TEST_ASSERT(strcmp(e[0].at, sites[NSITES - 1]) == 0);
+    INA_TEST_ASSERT(e[0].bytes == (uint64_t)nthreads * NSITES);
+    ina_mem_free(e);
+}
+
+int main(void)
+{
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    for (i = 0; i < NSITES; i++) {
+        snprintf(sites[i], sizeof(sites[i]), "site%d", i);
+    }
+    test_report(1);
+    /* exited threads hand their tables over, none is reported twice */
+    test_report(NTHREADS);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#define IS_ALIGNED(p, a) ((((uintptr_t)(p)) & ((a) - 1)) == 0)
+
+static void check_pool(ina_mempool_t *pool)
+{
+    size_t alignment;
+    void *p;
+    int i;
+
+    for (i = 0; i < 200; i++) {
+        alignment = (size_t)32 << (i % 5);
+        p = ina_mempool_dalloc_aligned(pool, 24 + (size_t)i, alignment);
+        INA_TEST_ASSERT(p != NULL);
+        INA_TEST_ASSERT(IS_ALIGNED(p, alignment));
+        memset(p, 0xAB, 24 + (size_t)i);
+        /* plain allocations keep the pool alignment */
+        p = ina_mempool_dalloc(pool, 1 + (size_t)i);
+        INA_TEST_ASSERT(p != NULL);
+        INA_TEST_ASSERT(IS_ALIGNED(p, INA_MEM_ALIGN_SIZE));
+    }
+}
+
+static void test_aligned(void)
+{
+    ina_mempool_t *pool;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    check_pool(pool);
+    ina_mempool_free(&pool);
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL,
+        INA_MEM_DYNAMIC|INA_MEM_THREADLOCAL, &pool));
+    check_pool(pool);
+    ina_mempool_free(&pool);
+}
+
+#ifdef INA_OS_LINUX
+#include <unistd.h>
+
+static void test_shared_aligned(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_info_t info;
+    char name[64];
+    size_t used;
+    void *p;
+    int i;
+
+    snprintf(name, sizeof(name), "/ina_test_aligned_%d", (int)getpid());
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(1024*1024, name,
+        INA_MEM_SHARED|INA_MEM_SHARED_CREATE|INA_MEM_SHARED_EXCL, &pool));
+    check_pool(pool);
+
+    /* no bytes are wasted once the cursor is at the alignment */
+    p = ina_mempool_dalloc_aligned(pool, 64, 64);
+    INA_TEST_ASSERT(p != NULL);
+    ina_mempool_info(pool, &info);
+    used = info.used;
+    for (i = 0; i < 100; i++) {
+        p = ina_mempool_dalloc_aligned(pool, 64, 64);
+        INA_TEST_ASSERT(p != NULL && IS_ALIGNED(p, 64));
+    }
+    ina_mempool_info(pool, &info);
+    INA_TEST_ASSERT(info.used == used + 100*64);
+    ina_mempool_free(&pool);
+}
+#endif
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_aligned();
+#ifdef INA_OS_LINUX
+    test_shared_aligned();
+#endif
+    return 0;
+}
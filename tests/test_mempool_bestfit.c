@@ -0,0 +1,149 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#define IN_CHUNK(p, base) ((unsigned char*)(p) >= (unsigned char*)(base) && \
+                           (unsigned char*)(p) < (unsigned char*)(base) + 4096)
+
+/* a request goes to the chunk with the least sufficient free space */
+static void test_best_fit(void)
+{
+    ina_mempool_t *pool;
+    void *a, *b, *c, *x;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    a = ina_mempool_dalloc(pool, 3000);
+    b = ina_mempool_dalloc(pool, 2000);
+    c = ina_mempool_dalloc(pool, 3500);
+    INA_TEST_ASSERT(a != NULL && b != NULL && c != NULL);
+    x = ina_mempool_dalloc(pool, 1000);
+    INA_TEST_ASSERT(IN_CHUNK(x, a));
+    x = ina_mempool_dalloc(pool, 1500);
+    INA_TEST_ASSERT(IN_CHUNK(x, b));
+    ina_mempool_free(&pool);
+}
+
+/* chunks are reused after a reset instead of growing the pool */
+static void test_churn(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_info_t info;
+    size_t size;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    for (i = 0; i < 100000; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 16 + (i*37)%900) != NULL);
+    }
+    ina_mempool_info(pool, &info);
+    size = info.size;
+    ina_mempool_reset(pool);
+    for (i = 0; i < 100000; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 16 + (i*37)%900) != NULL);
+    }
+    ina_mempool_info(pool, &info);
+    INA_TEST_ASSERT(info.size == size);
+    ina_mempool_free(&pool);
+}
+
+/* thousands of chunks, the holes they leave are filled before growing */
+static void test_many_chunks(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_info_t info;
+    size_t children;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    for (i = 0; i < 5000; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 3000 + (i % 7)*16) != NULL);
+    }
+    ina_mempool_info(pool, &info);
+    children = info.children;
+    for (i = 0; i < 5000; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 900) != NULL);
+    }
+    ina_mempool_info(pool, &info);
+    INA_TEST_ASSERT(info.children == children);
+    ina_mempool_free(&pool);
+}
+
+/* chunks in use at a mark are not filled, released chunks are reused */
+static void test_mark(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_info_t info;
+    ina_mempool_mark_t mark;
+    unsigned char *keep[64];
+    size_t size = 0;
+    int i, j, round;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    for (i = 0; i < 64; i++) {
+        keep[i] = ina_mempool_dalloc(pool, 2500);
+        memset(keep[i], i, 2500);
+    }
+    for (round = 0; round < 50; round++) {
+        mark = ina_mempool_mark(pool);
+        for (j = 0; j < 200; j++) {
+            unsigned char *p = ina_mempool_dalloc(pool, 100 + (j*53)%1500);
+            INA_TEST_ASSERT(p != NULL);
+            memset(p, 0xEE, 100 + (j*53)%1500);
+        }
+        INA_TEST_ASSERT_SUCCEED(ina_mempool_release(pool, mark));
+        ina_mempool_info(pool, &info);
+        if (round == 1) {
+            size = info.size;
+        } else if (round > 1) {
+            INA_TEST_ASSERT(info.size == size);
+        }
+    }
+    for (i = 0; i < 64; i++) {
+        for (j = 0; j < 2500; j++) {
+            INA_TEST_ASSERT(keep[i][j] == (unsigned char)i);
+        }
+    }
+    ina_mempool_free(&pool);
+}
+
+/* the chunks of a merged pool are reused by the destination */
+static void test_merge(void)
+{
+    ina_mempool_t *dest, *src;
+    ina_mempool_info_t info;
+    size_t children;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &dest));
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &src));
+    for (i = 0; i < 100; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(dest, 3000) != NULL);
+        INA_TEST_ASSERT(ina_mempool_dalloc(src, 2500) != NULL);
+    }
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_merge(dest, src));
+    ina_mempool_info(dest, &info);
+    children = info.children;
+    for (i = 0; i < 100; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(dest, 1500) != NULL);
+    }
+    ina_mempool_info(dest, &info);
+    INA_TEST_ASSERT(info.children == children);
+    ina_mempool_free(&dest);
+}
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_best_fit();
+    test_churn();
+    test_many_chunks();
+    test_mark();
+    test_merge();
+    return 0;
+}
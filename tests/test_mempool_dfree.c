@@ -0,0 +1,95 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#define NBLOCKS 512
+
+typedef struct {
+    unsigned char *ptr;
+    size_t size;
+} block_t;
+
+static void stamp(block_t *b, unsigned char v)
+{
+    if (b->size > 0) {
+        memset(b->ptr, v, b->size);
+    }
+}
+
+static int intact(const block_t *b, unsigned char v)
+{
+    size_t i;
+
+    for (i = 0; i < b->size; i++) {
+        if (b->ptr[i] != v) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Random allocations, frees and reallocations. Every live block carries its
+ * own byte pattern, blocks handed out twice overwrite each other.
+ */
+static void churn(uint32_t cf)
+{
+    static block_t blocks[NBLOCKS];
+    ina_mempool_t *pool;
+    size_t i, k, size;
+    unsigned char *p;
+    int it;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(8192, NULL, cf, &pool));
+    memset(blocks, 0, sizeof(blocks));
+    srand(11);
+    for (it = 0; it < 200000; it++) {
+        k = (size_t)rand() % NBLOCKS;
+        if (blocks[k].ptr != NULL) {
+            INA_TEST_ASSERT(intact(&blocks[k], (unsigned char)k));
+            if (blocks[k].size > 0 && rand() % 4 == 0) {
+                size = 1 + (size_t)rand() % 700;
+                p = ina_mempool_ralloc(pool, blocks[k].ptr, blocks[k].size, size);
+                INA_TEST_ASSERT(p != NULL);
+                blocks[k].ptr = p;
+                blocks[k].size = INA_MIN(blocks[k].size, size);
+                INA_TEST_ASSERT(intact(&blocks[k], (unsigned char)k));
+                blocks[k].size = size;
+                stamp(&blocks[k], (unsigned char)k);
+                continue;
+            }
+            ina_mempool_dfree(pool, blocks[k].ptr, blocks[k].size);
+            blocks[k].ptr = NULL;
+            continue;
+        }
+        /* tiny and empty requests included */
+        size = rand() % 8 == 0 ? (size_t)rand() % 9 : (size_t)rand() % 700;
+        blocks[k].ptr = ina_mempool_dalloc(pool, size);
+        INA_TEST_ASSERT(blocks[k].ptr != NULL);
+        if (!(cf&INA_MEM_BESTFIT)) {
+            INA_TEST_ASSERT(((uintptr_t)blocks[k].ptr & (INA_MEM_ALIGN_SIZE - 1)) == 0);
+        }
+        blocks[k].size = size;
+        stamp(&blocks[k], (unsigned char)k);
+    }
+    for (i = 0; i < NBLOCKS; i++) {
+        if (blocks[i].ptr != NULL) {
+            INA_TEST_ASSERT(intact(&blocks[i], (unsigned char)i));
+        }
+    }
+    ina_mempool_free(&pool);
+}
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    churn(INA_MEM_DYNAMIC);
+    churn(INA_MEM_DYNAMIC|INA_MEM_BESTFIT);
+    return 0;
+}
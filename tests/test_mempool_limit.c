@@ -0,0 +1,128 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#ifndef INA_OS_WIN32
+#include <pthread.h>
+#endif
+
+static void test_pool_limit(void)
+{
+    ina_mempool_t *pool;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    ina_mempool_set_limit(pool, 64*1024, NULL, NULL);
+    for (i = 0; i < 8; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 4000) != NULL);
+    }
+    INA_TEST_ASSERT(ina_mempool_dalloc(pool, 128*1024) == NULL);
+    ina_mempool_free(&pool);
+}
+
+#ifdef INA_OS_LINUX
+#include <unistd.h>
+
+/* released shared segments give their full size back to the global limit */
+static void test_shared_global_limit(void)
+{
+    ina_mempool_t *pool;
+    char name[64];
+    int i;
+
+    ina_mempool_set_global_limit(4*1024*1024, NULL, NULL);
+    for (i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "/ina_test_limit_%d_%d",
+                 (int)getpid(), i);
+        INA_TEST_ASSERT_SUCCEED(ina_mempool_new(1024*1024, name,
+            INA_MEM_SHARED|INA_MEM_SHARED_CREATE|INA_MEM_SHARED_EXCL, &pool));
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 100) != NULL);
+        ina_mempool_free(&pool);
+    }
+    ina_mempool_set_global_limit(0, NULL, NULL);
+}
+#endif
+
+#ifndef INA_OS_WIN32
+static int tag_a, tag_b;
+static volatile int bad_arg = 0;
+static volatile int stop = 0;
+
+static ina_rc_t refuse(ina_mempool_t *pool, size_t size, void *arg)
+{
+    INA_UNUSED(pool);
+    INA_UNUSED(size);
+    if (arg != &tag_a) {
+        bad_arg = 1;
+    }
+    return INA_ERROR(INA_ERR_POOL_LIMIT);
+}
+
+static ina_rc_t refuse_b(ina_mempool_t *pool, size_t size, void *arg)
+{
+    INA_UNUSED(pool);
+    INA_UNUSED(size);
+    if (arg != &tag_b) {
+        bad_arg = 1;
+    }
+    return INA_ERROR(INA_ERR_POOL_LIMIT);
+}
+
+static void *grow_pools(void *arg)
+{
+    ina_mempool_t *pool;
+
+    INA_UNUSED(arg);
+    while (!stop) {
+        if (INA_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool))) {
+            ina_mempool_dalloc(pool, 64*1024);
+            ina_mempool_free(&pool);
+        }
+        ina_err_reset();
+    }
+    return NULL;
+}
+
+/* the callback is always called with its own argument */
+static void test_global_limit_threads(void)
+{
+    pthread_t th[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        INA_TEST_ASSERT(pthread_create(&th[i], NULL, grow_pools, NULL) == 0);
+    }
+    for (i = 0; i < 20000; i++) {
+        if (i % 2 == 0) {
+            ina_mempool_set_global_limit(1, refuse, &tag_a);
+        } else {
+            ina_mempool_set_global_limit(2, refuse_b, &tag_b);
+        }
+    }
+    stop = 1;
+    for (i = 0; i < 4; i++) {
+        pthread_join(th[i], NULL);
+    }
+    ina_mempool_set_global_limit(0, NULL, NULL);
+    INA_TEST_ASSERT(!bad_arg);
+}
+#endif
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_pool_limit();
+#ifndef INA_OS_WIN32
+    test_global_limit_threads();
+#endif
+#ifdef INA_OS_LINUX
+    test_shared_global_limit();
+#endif
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+/* blocks freed before a mark are still recycled after its release */
+static void test_bins_kept(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_mark_t mark;
+    unsigned char *a, *b, *c, *p;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    a = ina_mempool_dalloc(pool, 256);
+    b = ina_mempool_dalloc(pool, 256);
+    c = ina_mempool_dalloc(pool, 256);
+    INA_TEST_ASSERT(a != NULL && b != NULL && c != NULL);
+    ina_mempool_dfree(pool, b, 256);
+
+    mark = ina_mempool_mark(pool);
+    for (i = 0; i < 40; i++) {
+        p = ina_mempool_dalloc(pool, 200);
+        INA_TEST_ASSERT(p != NULL);
+        /* the block freed before the mark is not handed out */
+        INA_TEST_ASSERT(p < b || p >= b + 256);
+        if (i % 3 == 0) {
+            ina_mempool_dfree(pool, p, 200);
+        }
+    }
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_release(pool, mark));
+
+    p = ina_mempool_dalloc(pool, 256);
+    INA_TEST_ASSERT(p == b);
+    ina_mempool_free(&pool);
+}
+
+/* blocks allocated before a mark are not recycled while it is set */
+static void test_dfree_below_mark(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_mark_t mark;
+    unsigned char *a, *b, *p, *q;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    a = ina_mempool_dalloc(pool, 128);
+    b = ina_mempool_dalloc(pool, 128);
+    memset(a, 0xAA, 128);
+    memset(b, 0xBB, 128);
+
+    mark = ina_mempool_mark(pool);
+    /* last allocation before the mark, the cursor does not move back */
+    ina_mempool_dfree(pool, b, 128);
+    p = ina_mempool_dalloc(pool, 128);
+    INA_TEST_ASSERT(p == b + 128);
+    /* nor is it shrunk below the mark */
+    ina_mempool_dfree(pool, p, 128);
+    INA_TEST_ASSERT(ina_mempool_ralloc(pool, b, 128, 64) == b);
+    p = ina_mempool_dalloc(pool, 128);
+    INA_TEST_ASSERT(p == b + 128);
+    /* nor does it go to the free lists */
+    ina_mempool_dfree(pool, a, 128);
+    q = ina_mempool_dalloc(pool, 128);
+    INA_TEST_ASSERT(q == p + 128);
+    memset(p, 0xEE, 256);
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_release(pool, mark));
+
+    INA_TEST_ASSERT(a[0] == 0xAA && a[127] == 0xAA);
+    INA_TEST_ASSERT(b[0] == 0xBB && b[127] == 0xBB);
+    p = ina_mempool_dalloc(pool, 128);
+    INA_TEST_ASSERT(p == b + 128);
+    ina_mempool_free(&pool);
+}
+
+/* blocks allocated after the mark are recycled, nested marks included */
+static void test_nested(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_mark_t outer, inner;
+    unsigned char *a, *b, *p;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    outer = ina_mempool_mark(pool);
+    a = ina_mempool_dalloc(pool, 512);
+    p = ina_mempool_dalloc(pool, 512);
+    ina_mempool_dfree(pool, a, 512);
+
+    inner = ina_mempool_mark(pool);
+    /* freed before the inner mark */
+    b = ina_mempool_dalloc(pool, 512);
+    INA_TEST_ASSERT(b != a);
+    ina_mempool_dfree(pool, p, 512);
+    ina_mempool_dfree(pool, b, 512);
+    INA_TEST_ASSERT(ina_mempool_dalloc(pool, 512) == b);
+    /* allocations fill the next chunks */
+    for (i = 0; i < 10; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 1000) != NULL);
+    }
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_release(pool, inner));
+
+    /* the free list of the outer mark is back */
+    INA_TEST_ASSERT(ina_mempool_dalloc(pool, 512) == a);
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_release(pool, outer));
+    ina_mempool_free(&pool);
+}
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_bins_kept();
+    test_dfree_below_mark();
+    test_nested();
+    return 0;
+}
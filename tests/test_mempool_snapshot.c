@@ -0,0 +1,95 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#ifdef INA_OS_LINUX
+static int filled(const unsigned char *p, size_t n, unsigned char v)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p[i] != v) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the view keeps the image of the snapshot while the pool is written */
+static void test_copy_on_write(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_snapshot_t *snap, *other = NULL;
+    unsigned char *p, *q, *r;
+    const unsigned char *v;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(64*1024, NULL,
+                            INA_MEM_DYNAMIC|INA_MEM_SNAPSHOT, &pool));
+    p = ina_mempool_dalloc(pool, 20000);
+    INA_TEST_ASSERT(p != NULL);
+    memset(p, 'A', 20000);
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_snapshot(pool, &snap));
+    /* one snapshot at a time */
+    INA_TEST_ASSERT(INA_FAILED(ina_mempool_snapshot(pool, &other)));
+    ina_err_reset();
+    memset(p, 'B', 10000);
+    q = ina_mempool_dalloc(pool, 100);
+    INA_TEST_ASSERT(q != NULL);
+    memset(q, 'C', 100);
+    r = ina_mempool_dalloc(pool, 60000);
+    INA_TEST_ASSERT(r != NULL);
+
+    v = ina_mempool_snapshot_ptr(snap, p);
+    INA_TEST_ASSERT(v != NULL && v != p);
+    INA_TEST_ASSERT(filled(v, 20000, 'A'));
+    INA_TEST_ASSERT(filled(p, 10000, 'B') && filled(p + 10000, 10000, 'A'));
+    /* allocated after the snapshot, in the same or a new chunk */
+    v = ina_mempool_snapshot_ptr(snap, q);
+    INA_TEST_ASSERT(v != NULL && filled(v, 100, 0));
+    INA_TEST_ASSERT(ina_mempool_snapshot_ptr(snap, r) == NULL);
+
+    /* changes of the pool survive the snapshot */
+    ina_mempool_snapshot_free(&snap);
+    INA_TEST_ASSERT(snap == NULL);
+    INA_TEST_ASSERT(filled(p, 10000, 'B') && filled(p + 10000, 10000, 'A'));
+    INA_TEST_ASSERT(filled(q, 100, 'C'));
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_snapshot(pool, &snap));
+    v = ina_mempool_snapshot_ptr(snap, p);
+    INA_TEST_ASSERT(v != NULL && filled(v, 10000, 'B'));
+    memset(p, 'D', 20000);
+    /* the snapshot stays readable after its pool is gone */
+    ina_mempool_free(&pool);
+    INA_TEST_ASSERT(filled(v, 10000, 'B') && filled(v + 10000, 10000, 'A'));
+    ina_mempool_snapshot_free(&snap);
+}
+
+/* only INA_MEM_SNAPSHOT pools take snapshots */
+static void test_plain_pool(void)
+{
+    ina_mempool_t *pool;
+    ina_mempool_snapshot_t *snap = NULL;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(4096, NULL, INA_MEM_DYNAMIC, &pool));
+    INA_TEST_ASSERT(INA_FAILED(ina_mempool_snapshot(pool, &snap)));
+    ina_err_reset();
+    ina_mempool_free(&pool);
+}
+#endif
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+#ifdef INA_OS_LINUX
+    test_copy_on_write();
+    test_plain_pool();
+#endif
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#ifndef INA_OS_WIN32
+#include <pthread.h>
+#endif
+
+#define NPOOLS 256
+#define NCOLLIDE 6
+#define NTHREADS 4
+#define NALLOCS 20000
+
+/* set of the per-thread chunk cache a pool maps to */
+#define CACHE_SET(p) ((((uintptr_t)(p)) >> 6) & 15)
+
+static ina_mempool_t *pools[NPOOLS];
+static ina_mempool_t *collide[NCOLLIDE];
+
+static void test_colliding_pools(void)
+{
+    ina_mempool_info_t info;
+    int i, k;
+
+    /* two pools sharing a cache set must not claim a new chunk per switch */
+    for (i = 0; i < 1000; i++) {
+        for (k = 0; k < 2; k++) {
+            INA_TEST_ASSERT(ina_mempool_dalloc(collide[k], 16) != NULL);
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        ina_mempool_info(collide[k], &info);
+        INA_TEST_ASSERT(info.children == 0);
+    }
+
+    /* more colliding pools than ways, chunks are handed back and reused */
+    for (i = 0; i < 1000; i++) {
+        for (k = 0; k < NCOLLIDE; k++) {
+            INA_TEST_ASSERT(ina_mempool_dalloc(collide[k], 16) != NULL);
+        }
+    }
+    for (k = 0; k < NCOLLIDE; k++) {
+        ina_mempool_info(collide[k], &info);
+        INA_TEST_ASSERT(info.children <= 2);
+    }
+
+    /* requests not fitting the claimed chunk */
+    for (i = 0; i < 200; i++) {
+        INA_TEST_ASSERT(ina_mempool_dalloc(collide[0], 10000) != NULL);
+        INA_TEST_ASSERT(ina_mempool_dalloc(collide[0], 9000) != NULL);
+    }
+}
+
+#ifndef INA_OS_WIN32
+static void *worker(void *arg)
+{
+    unsigned char *p;
+    int i, k;
+
+    INA_UNUSED(arg);
+    for (i = 0; i < NALLOCS; i++) {
+        for (k = 0; k < NCOLLIDE; k++) {
+            p = ina_mempool_dalloc(collide[k], 16);
+            INA_TEST_ASSERT(p != NULL);
+            p[0] = (unsigned char)i;
+            p[15] = (unsigned char)k;
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t th[NTHREADS];
+    ina_mempool_info_t info;
+    int i, k;
+
+    for (k = 0; k < NCOLLIDE; k++) {
+        ina_mempool_reset(collide[k]);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        INA_TEST_ASSERT(pthread_create(&th[i], NULL, worker, NULL) == 0);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        pthread_join(th[i], NULL);
+    }
+    for (k = 0; k < NCOLLIDE; k++) {
+        ina_mempool_info(collide[k], &info);
+        INA_TEST_ASSERT(info.used == NTHREADS*NALLOCS*16);
+    }
+}
+#endif
+
+int main(void)
+{
+    int i, n = 0;
+
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    for (i = 0; i < NPOOLS; i++) {
+        INA_TEST_ASSERT_SUCCEED(ina_mempool_new(16384, NULL,
+            INA_MEM_THREADLOCAL|INA_MEM_DYNAMIC, &pools[i]));
+    }
+    for (i = 0; i < NPOOLS && n < NCOLLIDE; i++) {
+        if (CACHE_SET(pools[i]) == CACHE_SET(pools[0])) {
+            collide[n++] = pools[i];
+        }
+    }
+    INA_TEST_ASSERT(n == NCOLLIDE);
+
+    test_colliding_pools();
+#ifndef INA_OS_WIN32
+    test_threads();
+#endif
+
+    for (i = 0; i < NPOOLS; i++) {
+        ina_mempool_free(&pools[i]);
+    }
+    return 0;
+}
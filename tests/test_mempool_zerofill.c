@@ -0,0 +1,77 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+static int is_zero(const unsigned char *p, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_lazy_zero(void)
+{
+    ina_mempool_t *pool;
+    unsigned char *a;
+
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(65536, NULL, INA_MEM_DYNAMIC, &pool));
+    a = ina_mempool_dalloc(pool, 1000);
+    INA_TEST_ASSERT(is_zero(a, 1000));
+    memset(a, 0xAB, 1000);
+    ina_mempool_clear(pool);
+    a = ina_mempool_dalloc(pool, 2000);
+    INA_TEST_ASSERT(is_zero(a, 2000));
+    ina_mempool_free(&pool);
+}
+
+/* clear zeroes NOZEROFILL chunks whose contents were never tracked */
+static void test_nozerofill_clear(void)
+{
+    ina_mempool_t *pool;
+    unsigned char *a;
+    void *junk[64];
+    int i, j;
+
+    /* leave garbage on the heap for the chunks to come */
+    for (i = 0; i < 64; i++) {
+        junk[i] = malloc(70000);
+        memset(junk[i], 0xCD, 70000);
+    }
+    for (i = 0; i < 64; i++) {
+        free(junk[i]);
+    }
+    for (i = 0; i < 8; i++) {
+        INA_TEST_ASSERT_SUCCEED(ina_mempool_new(65536, NULL,
+            INA_MEM_NOZEROFILL|INA_MEM_DYNAMIC, &pool));
+        a = ina_mempool_dalloc(pool, 100);
+        memset(a, 0xAB, 100);
+        INA_TEST_ASSERT(ina_mempool_dalloc(pool, 100000) != NULL);
+        ina_mempool_clear(pool);
+        for (j = 0; j < 3; j++) {
+            a = ina_mempool_dalloc(pool, 20000);
+            INA_TEST_ASSERT(is_zero(a, 20000));
+        }
+        a = ina_mempool_dalloc(pool, 100000);
+        INA_TEST_ASSERT(is_zero(a, 100000));
+        ina_mempool_free(&pool);
+    }
+}
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_lazy_zero();
+    test_nozerofill_clear();
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#ifndef INA_OS_WIN32
+#include <pthread.h>
+#endif
+
+static void test_list_usage(void)
+{
+    ina_list_t *list;
+    size_t usage;
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_list_new(INA_LIST_CF_DEFAULT, &list));
+    ina_list_usage(list, &usage);
+    INA_TEST_ASSERT(usage <= 8192);
+    for (i = 0; i < 10000; i++) {
+        INA_TEST_ASSERT_SUCCEED(ina_list_insert_tail_data(list, NULL));
+    }
+    ina_list_free(&list);
+}
+
+static void test_alloc_dealloc(void)
+{
+    ina_slab_t *slab;
+    ina_slab_info_t info;
+    void *p[1000];
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_slab_new(24, INA_SLAB_DEFAULT, &slab));
+    for (i = 0; i < 1000; i++) {
+        p[i] = ina_slab_alloc(slab);
+        INA_TEST_ASSERT(p[i] != NULL);
+        memset(p[i], i, 24);
+    }
+    ina_slab_info(slab, &info);
+    INA_TEST_ASSERT(info.used == 1000);
+    for (i = 0; i < 1000; i += 2) {
+        ina_slab_dealloc(slab, p[i]);
+    }
+    ina_slab_info(slab, &info);
+    INA_TEST_ASSERT(info.used == 500);
+    ina_slab_free(&slab);
+}
+
+#ifndef INA_OS_WIN32
+static ina_slab_t *shared_slab;
+static volatile int phase;
+
+static void *use_once(void *arg)
+{
+    INA_UNUSED(arg);
+    ina_slab_dealloc(shared_slab, ina_slab_alloc(shared_slab));
+    return NULL;
+}
+
+static void *use_twice(void *arg)
+{
+    INA_UNUSED(arg);
+    ina_slab_dealloc(shared_slab, ina_slab_alloc(shared_slab));
+    phase = 1;
+    while (phase != 2) {}
+    ina_slab_dealloc(shared_slab, ina_slab_alloc(shared_slab));
+    phase = 3;
+    while (phase != 4) {}
+    return NULL;
+}
+
+static void test_magazines(void)
+{
+    ina_slab_info_t info;
+    pthread_t th;
+    int i;
+
+    /* exiting threads flush their magazines */
+    INA_TEST_ASSERT_SUCCEED(ina_slab_new(32, INA_SLAB_THREADSAFE, &shared_slab));
+    for (i = 0; i < 100; i++) {
+        INA_TEST_ASSERT(pthread_create(&th, NULL, use_once, NULL) == 0);
+        pthread_join(th, NULL);
+    }
+    ina_slab_info(shared_slab, &info);
+    INA_TEST_ASSERT(info.used == 0);
+
+    /* a magazine of a freed slab is rebuilt for the new one */
+    phase = 0;
+    INA_TEST_ASSERT(pthread_create(&th, NULL, use_twice, NULL) == 0);
+    while (phase != 1) {}
+    ina_slab_free(&shared_slab);
+    INA_TEST_ASSERT_SUCCEED(ina_slab_new(32, INA_SLAB_THREADSAFE, &shared_slab));
+    phase = 2;
+    while (phase != 3) {}
+    ina_slab_info(shared_slab, &info);
+    INA_TEST_ASSERT(info.used != 0);
+    phase = 4;
+    pthread_join(th, NULL);
+    ina_slab_info(shared_slab, &info);
+    INA_TEST_ASSERT(info.used == 0);
+    ina_slab_free(&shared_slab);
+}
+
+static void *cache_objects(void *arg)
+{
+    void *p[8];
+    int i;
+
+    INA_UNUSED(arg);
+    for (i = 0; i < 8; i++) {
+        p[i] = ina_slab_alloc(shared_slab);
+    }
+    for (i = 0; i < 8; i++) {
+        ina_slab_dealloc(shared_slab, p[i]);
+    }
+    phase = 1;
+    while (phase != 2) {}
+    return NULL;
+}
+
+static void test_merge_magazines(void)
+{
+    ina_slab_t *dest;
+    ina_slab_info_t info;
+    pthread_t th;
+    void *p[100];
+    int i;
+
+    INA_TEST_ASSERT_SUCCEED(ina_slab_new(32, INA_SLAB_THREADSAFE, &dest));
+    INA_TEST_ASSERT_SUCCEED(ina_slab_new(32, INA_SLAB_THREADSAFE, &shared_slab));
+    for (i = 0; i < 100; i++) {
+        p[i] = ina_slab_alloc(shared_slab);
+    }
+    phase = 0;
+    INA_TEST_ASSERT(pthread_create(&th, NULL, cache_objects, NULL) == 0);
+    while (phase != 1) {}
+    INA_TEST_ASSERT_SUCCEED(ina_slab_merge(dest, shared_slab));
+    /* the magazine of the thread is not flushed into the empty src */
+    phase = 2;
+    pthread_join(th, NULL);
+    ina_slab_info(shared_slab, &info);
+    INA_TEST_ASSERT(info.used == 0 && info.pages == 0);
+
+    for (i = 0; i < 100; i++) {
+        ina_slab_dealloc(dest, p[i]);
+    }
+    for (i = 0; i < 100; i++) {
+        p[i] = ina_slab_alloc(shared_slab);
+        INA_TEST_ASSERT(p[i] != NULL);
+        ina_slab_dealloc(shared_slab, p[i]);
+    }
+    ina_slab_free(&shared_slab);
+    ina_slab_free(&dest);
+}
+#endif
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_list_usage();
+    test_alloc_dealloc();
+#ifndef INA_OS_WIN32
+    test_magazines();
+    test_merge_magazines();
+#endif
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+#ifndef INA_OS_WIN32
+static int fail_realloc = 0;
+
+static void *t_alloc(void *ctx, size_t size)
+{
+    INA_UNUSED(ctx);
+    return malloc(size);
+}
+
+static void *t_realloc(void *ctx, void *ptr, size_t size)
+{
+    INA_UNUSED(ctx);
+    return fail_realloc ? NULL : realloc(ptr, size);
+}
+
+static void t_free(void *ctx, void *ptr)
+{
+    INA_UNUSED(ctx);
+    free(ptr);
+}
+
+static void *t_alloc_aligned(void *ctx, size_t alignment, size_t size)
+{
+    void *p;
+
+    INA_UNUSED(ctx);
+    return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
+/* a heap string that can not grow is left as it was */
+static void test_heap(void)
+{
+    ina_str_t s, r;
+    char big[200];
+
+    memset(big, 'x', sizeof(big));
+    s = ina_str_new_fromcstr("hello");
+    INA_TEST_ASSERT(s != NULL);
+    fail_realloc = 1;
+    r = ina_str_ncat(s, big, sizeof(big));
+    INA_TEST_ASSERT(r == NULL);
+    r = ina_str_ncpy(s, big, sizeof(big));
+    INA_TEST_ASSERT(r == NULL);
+    r = ina_str_reserve(s, 1000);
+    INA_TEST_ASSERT(r == NULL);
+    INA_TEST_ASSERT(ina_str_len(s) == 5 && strcmp(s, "hello") == 0);
+    fail_realloc = 0;
+
+    s = ina_str_ncat(s, big, sizeof(big));
+    INA_TEST_ASSERT(s != NULL && ina_str_len(s) == 5 + sizeof(big));
+    INA_TEST_ASSERT(strncmp(s, "hello", 5) == 0 && s[5 + sizeof(big) - 1] == 'x');
+    ina_str_free(s);
+}
+#endif
+
+/* pooled strings grow only with their pool and only while it has room */
+static void test_pooled(void)
+{
+    ina_mempool_t *pool;
+    ina_str_t s, r;
+    char big[2000];
+
+    memset(big, 'y', sizeof(big));
+    INA_TEST_ASSERT_SUCCEED(ina_mempool_new(1024, NULL, INA_MEM_FIXED, &pool));
+    s = ina_str_new_using_pool(8, pool);
+    INA_TEST_ASSERT(s != NULL);
+    s = ina_str_ncat_using_pool(s, "abc", 3, pool);
+    INA_TEST_ASSERT(s != NULL);
+
+    /* the pool of the string is unknown */
+    r = ina_str_ncpy(s, big, 100);
+    INA_TEST_ASSERT(r == NULL);
+    r = ina_str_ncat(s, big, 100);
+    INA_TEST_ASSERT(r == NULL);
+    INA_TEST_ASSERT(strcmp(s, "abc") == 0);
+    /* fits without growing */
+    r = ina_str_ncpy(s, "defg", 4);
+    INA_TEST_ASSERT(r == s && strcmp(s, "defg") == 0);
+
+    /* the pool is full */
+    r = ina_str_ncat_using_pool(s, big, sizeof(big), pool);
+    INA_TEST_ASSERT(r == NULL);
+    INA_TEST_ASSERT(strcmp(s, "defg") == 0);
+    s = ina_str_ncat_using_pool(s, big, 100, pool);
+    INA_TEST_ASSERT(s != NULL && ina_str_len(s) == 104);
+    ina_mempool_free(&pool);
+}
+
+int main(void)
+{
+#ifndef INA_OS_WIN32
+    ina_mem_allocator_t a;
+
+    a.alloc = t_alloc;
+    a.realloc = t_realloc;
+    a.free = t_free;
+    a.alloc_aligned = t_alloc_aligned;
+    a.usable_size = NULL;
+    a.ctx = NULL;
+    INA_TEST_ASSERT_SUCCEED(ina_mem_set_allocator(&a));
+#endif
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+#ifndef INA_OS_WIN32
+    test_heap();
+#endif
+    test_pooled();
+    return 0;
+}
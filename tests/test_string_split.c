@@ -0,0 +1,98 @@
+/*
+ * Copyright INAOS GmbH, Thalwil, 2018. All rights reserved
+ *
+ * This software is the confidential and proprietary information of INAOS GmbH
+ * ("Confidential Information"). You shall not disclose such Confidential
+ * Information and shall use it only in accordance with the terms of the
+ * license agreement you entered into with INAOS GmbH.
+ */
+#include "test.h"
+
+/* reference byte loop, returns token offsets and lengths */
+static size_t ref_split(const char *str, const char *sep, size_t *off,
+                        size_t *tlen)
+{
+    size_t n = 0, j, start = 0, seplen, len;
+
+    len = strlen(str);
+    seplen = strlen(sep);
+    if (len == 0 || seplen == 0) {
+        return 0;
+    }
+    for (j = 0; j < len-1; j++) {
+        if (strncmp(str+j, sep, seplen) == 0) {
+            off[n] = start;
+            tlen[n] = j-start;
+            n++;
+            start = j+seplen;
+            j += seplen-1;
+        }
+    }
+    off[n] = start;
+    tlen[n] = len-start;
+    return n+1;
+}
+
+static void test_split_reference(void)
+{
+    size_t i, n, count, off[256], tlen[256], len, seplen;
+    char s[256], sep[4];
+    ina_str_t *t;
+    int it;
+
+    srand(7);
+    for (it = 0; it < 100000; it++) {
+        len = rand() % 120;
+        seplen = 1 + rand() % 3;
+        for (i = 0; i < len; i++) {
+            s[i] = 'a' + rand() % 3;
+        }
+        s[len] = 0;
+        for (i = 0; i < seplen; i++) {
+            sep[i] = 'a' + rand() % 3;
+        }
+        sep[seplen] = 0;
+        n = ref_split(s, sep, off, tlen);
+        t = ina_str_split(s, sep, &count);
+        if (n == 0) {
+            INA_TEST_ASSERT(t == NULL && count == 0);
+            continue;
+        }
+        INA_TEST_ASSERT(count == n);
+        for (i = 0; i < n; i++) {
+            INA_TEST_ASSERT(ina_str_len(t[i]) == tlen[i]);
+            INA_TEST_ASSERT(memcmp(t[i], s + off[i], tlen[i]) == 0);
+            INA_TEST_ASSERT(t[i][tlen[i]] == 0);
+        }
+        INA_TEST_ASSERT(t[n] == NULL);
+        /* tokens are independent strings */
+        ina_str_free(t[0]);
+        t[0] = ina_str_new_fromcstr("x");
+        ina_str_split_free_tokens(t);
+    }
+}
+
+static void test_split_iter(void)
+{
+    ina_str_split_iter_t it;
+    ina_strview_t tok;
+    const char *exp[] = { "a", "", "bc", "" };
+    size_t n = 0;
+
+    ina_str_split_iter_init(&it, ina_strview_fromcstr("a,,bc,"), ",");
+    while (ina_str_split_iter_next(&it, &tok)) {
+        INA_TEST_ASSERT(n < 4);
+        INA_TEST_ASSERT(tok.len == strlen(exp[n]));
+        INA_TEST_ASSERT(memcmp(tok.ptr, exp[n], tok.len) == 0);
+        n++;
+    }
+    INA_TEST_ASSERT(n == 4);
+}
+
+int main(void)
+{
+    INA_TEST_ASSERT_SUCCEED(ina_init());
+    test_split_reference();
+    test_split_iter();
+    return 0;
+}